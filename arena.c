@@ -0,0 +1,122 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Scratch memory for one object at a time
+ *  Copyright (C) 2018 Christopher Bazley
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public Licence as published by
+ *  the Free Software Foundation; either version 2 of the Licence, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public Licence for more details.
+ *
+ *  You should have received a copy of the GNU General Public Licence
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* ISO library header files */
+#include <stdlib.h>
+#include <stddef.h>
+
+/* Local header files */
+#include "arena.h"
+#include "misc.h"
+
+enum {
+  MinBlockSize = 1 << 14
+};
+
+/* Used to ensure that allocations are suitably aligned for any type */
+typedef union {
+  long double ld;
+  long long int ll;
+  void *p;
+  void (*fn)(void);
+} ArenaAlign;
+
+struct ArenaBlock {
+  _Optional ArenaBlock *next;
+  size_t size;
+  ArenaAlign data[];
+};
+
+void arena_init(Arena * const arena)
+{
+  assert(arena != NULL);
+  *arena = (Arena){.blocks = NULL, .used = 0, .total = 0};
+}
+
+static size_t align_size(size_t const size)
+{
+  return ((size + sizeof(ArenaAlign) - 1) / sizeof(ArenaAlign)) *
+         sizeof(ArenaAlign);
+}
+
+static _Optional ArenaBlock *add_block(Arena * const arena, size_t size)
+{
+  assert(arena != NULL);
+
+  if (size < MinBlockSize) {
+    size = MinBlockSize;
+  }
+
+  _Optional ArenaBlock *const block = malloc(sizeof(*block) + size);
+  if (block != NULL) {
+    DEBUGF("Allocated arena block of %zu bytes\n", size);
+    block->next = arena->blocks;
+    block->size = size;
+    arena->blocks = block;
+    arena->used = 0;
+    arena->total += size;
+  }
+  return block;
+}
+
+_Optional void *arena_alloc(Arena * const arena, size_t const size)
+{
+  assert(arena != NULL);
+
+  size_t const aligned = align_size(size);
+  _Optional ArenaBlock *block = arena->blocks;
+  if ((block == NULL) || (block->size - arena->used < aligned)) {
+    /* Grow geometrically so that few blocks are needed */
+    block = add_block(arena, aligned > arena->total ? aligned : arena->total);
+    if (block == NULL) {
+      return NULL;
+    }
+  }
+
+  void *const p = (char *)block->data + arena->used;
+  arena->used += aligned;
+  return p;
+}
+
+void arena_reset(Arena * const arena)
+{
+  assert(arena != NULL);
+
+  /* Replace multiple blocks with one big enough for all of them the next
+     time the arena is used, so that it doesn't need to grow again. */
+  if ((arena->blocks != NULL) && (arena->blocks->next != NULL)) {
+    size_t const total = arena->total;
+    arena_free(arena);
+    (void)add_block(arena, total);
+  }
+  arena->used = 0;
+}
+
+void arena_free(Arena * const arena)
+{
+  assert(arena != NULL);
+
+  for (_Optional ArenaBlock *block = arena->blocks; block != NULL; ) {
+    _Optional ArenaBlock *const next = block->next;
+    free(block);
+    block = next;
+  }
+  arena_init(arena);
+}
@@ -0,0 +1,39 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Scratch memory for one object at a time
+ *  Copyright (C) 2018 Christopher Bazley
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+/* ISO C library headers */
+#include <stddef.h>
+
+#if !defined(USE_OPTIONAL) && !defined(_Optional)
+#define _Optional
+#endif
+
+typedef struct ArenaBlock ArenaBlock;
+
+/* Memory is allocated by bumping a pointer and is only released all at
+   once, by resetting the arena. Once an arena has grown to fit the largest
+   object, no further memory needs to be allocated from the heap. */
+typedef struct {
+  _Optional ArenaBlock *blocks; /* Most recently allocated first */
+  size_t used; /* Bytes used in the first block */
+  size_t total; /* Bytes in all blocks */
+} Arena;
+
+void arena_init(Arena *arena);
+
+_Optional void *arena_alloc(Arena *arena, size_t size);
+
+/* Release all memory allocated from the arena. If it has more than one
+   block then they are freed and replaced with a single block big enough
+   for all of them; otherwise, the existing block is reused. */
+void arena_reset(Arena *arena);
+
+void arena_free(Arena *arena);
+
+#endif /* ARENA_H */
@@ -39,31 +39,237 @@
 /* StreamLib headers */
 #include "Reader.h"
 #include "ReaderGKey.h"
-#include "ReaderRaw.h"
+#include "ReaderMem.h"
 
 /* Local headers */
 #include "flags.h"
 #include "parser.h"
+#include "jobs.h"
+#include "filebuf.h"
+#include "sidecar.h"
 #include "version.h"
 #include "misc.h"
 
 enum {
-  HistoryLog2 = 9 /* Base 2 logarithm of the history size used by
-                     the compression algorithm */
+  HistoryLog2 = 9, /* Base 2 logarithm of the history size used by
+                      the compression algorithm */
+  OutputBufferSize = 1 << 20,
+  NumMaps = 16 /* Number of maps in Extra Missions */
 };
 
+/* Files belonging to a set of maps, in the order they are loaded */
+enum {
+  MapFile_Land,
+  MapFile_LandEx,
+  MapFile_Obj3D = MapFile_LandEx + NumMaps,
+  MapFile_Count = MapFile_Obj3D + NumMaps
+};
+
+typedef struct {
+  char path[FILENAME_MAX];
+  const char *type;
+  FileBuffer fb;
+  Reader r;
+  bool success;
+} MapFile;
+
+typedef struct {
+  MapFile files[MapFile_Count];
+  bool raw;
+} MapSet;
+
+/* Styles of output which can be written from one conversion of each
+   object, in the order their files are written */
+typedef struct {
+  const char *name;
+  unsigned int flags;
+} VariantStyle;
+
+static const VariantStyle variant_styles[] = {
+  {"plain", 0},
+  {"fans", FLAGS_TRIANGLE_FANS},
+  {"strips", FLAGS_TRIANGLE_STRIPS},
+  {"negative", FLAGS_NEGATIVE_INDICES}
+};
+
+enum {
+  NumVariantStyles = ARRAY_SIZE(variant_styles)
+};
+
+static bool mem_reader_init(Reader * const r, FileBuffer * const fb,
+                            FILE * const f, const bool raw,
+                            const char * const type,
+                            const char * const file_name)
+{
+  assert(r != NULL);
+  assert(fb != NULL);
+  assert(f != NULL);
+  assert(type != NULL);
+  assert(file_name != NULL);
+
+  if (raw) {
+    if (!file_buffer_load(fb, f)) {
+      fprintf(stderr, "Failed to load %s file '%s': %s\n",
+              type, file_name, strerror(errno));
+      return false;
+    }
+  } else {
+    /* Decompress the whole file up-front so that seeking to each object
+       doesn't require any of it to be decompressed again. */
+    Reader rgkey;
+    if (!reader_gkey_init(&rgkey, HistoryLog2, f)) {
+      fprintf(stderr, "Failed to initialize decompression of %s file '%s'\n",
+              type, file_name);
+      return false;
+    }
+    bool const success = file_buffer_read(fb, &rgkey);
+    reader_destroy(&rgkey);
+    if (!success) {
+      fprintf(stderr, "Failed to decompress %s file '%s'\n",
+              type, file_name);
+      return false;
+    }
+  }
+
+  reader_mem_init(r, file_buffer_get_data(fb), file_buffer_get_size(fb));
+  return true;
+}
+
+static bool make_output_name(char (* const name)[FILENAME_MAX],
+                             const char * const output_file,
+                             const char * const tag)
+{
+  assert(name != NULL);
+  assert(output_file != NULL);
+  assert(tag != NULL);
+
+  /* The tag (e.g. a map number) replaces the first '#' in the output
+     file name, or else it is inserted before any extension of the leaf
+     name (or appended if there is none). */
+  const char *suffix = strchr(output_file, '#');
+  int prefix_len;
+  if (suffix != NULL) {
+    prefix_len = (int)(suffix - output_file);
+    ++suffix;
+  } else {
+    const char *const sep = strrchr(output_file, PATH_SEPARATOR);
+    const char *const leaf = sep != NULL ? sep + 1 : output_file;
+    const char *const ext = strrchr(leaf, EXTENSION_SEPARATOR);
+    if ((ext != NULL) && (ext > leaf)) {
+      prefix_len = (int)(ext - output_file);
+      suffix = ext;
+    } else {
+      prefix_len = (int)strlen(output_file);
+      suffix = "";
+    }
+  }
+
+  int const len = snprintf(*name, sizeof(*name), "%.*s%s%s", prefix_len,
+                           output_file, tag, suffix);
+
+  if ((len < 0) || ((size_t)len >= sizeof(*name))) {
+    fprintf(stderr, "Output file name '%s' is too long\n", output_file);
+    return false;
+  }
+  return true;
+}
+
+static _Optional FILE *open_output_file(const char * const output_file,
+                                        const unsigned int flags)
+{
+  assert(output_file != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  if (flags & FLAGS_VERBOSE)
+    printf("Opening output file '%s'\n", output_file);
+
+  _Optional FILE *const out = fopen(output_file, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Failed to open output file '%s': %s\n",
+                    output_file, strerror(errno));
+    return NULL;
+  }
+
+  /* Output is written in many small pieces, so a large buffer greatly
+     reduces the number of system calls. It doesn't matter if this fails
+     because the stream is still usable with its default buffer. */
+  if (setvbuf(&*out, NULL, _IOFBF, OutputBufferSize)) {
+    DEBUGF("Failed to set output buffer size\n");
+  }
+  return out;
+}
+
+static bool close_output_file(FILE * const out,
+                              const char * const output_file,
+                              const unsigned int flags)
+{
+  assert(out != NULL);
+  assert(output_file != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  if (flags & FLAGS_VERBOSE)
+    printf("Closing output file '%s'\n", output_file);
+
+  if (fclose(out)) {
+    fprintf(stderr, "Failed to close output file '%s': %s\n",
+                    output_file, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static bool open_variant(OutputVariant * const variant,
+                         char (* const name)[FILENAME_MAX],
+                         const char * const output_file,
+                         _Optional const char * const tag,
+                         const unsigned int style, const unsigned int flags)
+{
+  assert(variant != NULL);
+  assert(name != NULL);
+  assert(output_file != NULL);
+  assert(!(style & ~FLAGS_OUTPUT_STYLE));
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* Only the name of a variant has a tag (such as "fans") inserted */
+  if (tag != NULL) {
+    if (!make_output_name(name, output_file, &*tag)) {
+      return false;
+    }
+  } else {
+    int const len = snprintf(*name, sizeof(*name), "%s", output_file);
+    if ((len < 0) || ((size_t)len >= sizeof(*name))) {
+      fprintf(stderr, "Output file name '%s' is too long\n", output_file);
+      return false;
+    }
+  }
+
+  _Optional FILE *const out = open_output_file(*name, flags);
+  if (out == NULL) {
+    return false;
+  }
+
+  *variant = (OutputVariant){.out = &*out, .flags = style};
+  return true;
+}
+
 static bool process_file(const char * const model_file,
                          _Optional const char * const index_file,
                          _Optional const char * const output_file,
+                         _Optional const char * const output_dir,
+                         _Optional const char * const sidecar_file,
                          const int first, const int last,
                          _Optional const char * const name,
                          const long int data_start,
                          const char * const mtl_file,
-                         double const thick,
+                         double const thick, const int jobs,
+                         const unsigned int variants,
                          const unsigned int flags, const bool time,
                          const bool raw)
 {
-  _Optional FILE *out = NULL, *index = NULL, *models = NULL;
+  _Optional FILE *index = NULL, *models = NULL;
+  OutputVariant out[NumVariantStyles];
+  char out_names[NumVariantStyles][FILENAME_MAX];
+  int nout = 0;
   bool success = true;
 
   assert(model_file != NULL);
@@ -104,50 +310,73 @@ static bool process_file(const char * const model_file,
 
   if (success) {
     if (flags & (FLAGS_LIST|FLAGS_SUMMARY)) {
-      out = NULL; /* No OBJ-format output */
-    } else if (output_file != NULL) {
-      if (flags & FLAGS_VERBOSE)
-        printf("Opening output file '%s'\n", output_file);
+      /* No OBJ-format output */
+    } else if (output_dir != NULL) {
+      /* One output file per object */
+    } else if (output_file == NULL) {
+      /* Default output is to standard output stream */
+      assert(variants == 0);
+      out[nout++] = (OutputVariant){.out = stdout,
+                                    .flags = flags & FLAGS_OUTPUT_STYLE};
 
-      out = fopen(&*output_file, "w");
-      if (out == NULL) {
-        fprintf(stderr, "Failed to open output file '%s': %s\n",
-                        output_file, strerror(errno));
-        success = false;
+      if (setvbuf(stdout, NULL, _IOFBF, OutputBufferSize)) {
+        DEBUGF("Failed to set output buffer size\n");
+      }
+    } else if (variants == 0) {
+      success = open_variant(out, out_names, &*output_file, NULL,
+                             flags & FLAGS_OUTPUT_STYLE, flags);
+      if (success) {
+        nout = 1;
       }
     } else {
-      /* Default output is to standard output stream */
-      out = stdout;
+      for (int v = 0; success && (v < NumVariantStyles); ++v) {
+        if (variants & (1u << v)) {
+          success = open_variant(out + nout, out_names + nout,
+                                 &*output_file, variant_styles[v].name,
+                                 variant_styles[v].flags, flags);
+          if (success) {
+            ++nout;
+          }
+        }
+      }
     }
   }
 
   if (success && models) {
     const clock_t start_time = time ? clock() : 0;
 
+    /* Input is parsed directly from memory instead of making library
+       calls to read (and possibly decompress) every byte. */
+    FileBuffer bmodels = {.data = NULL}, bindex = {.data = NULL};
+    Sidecar smodels = {.fb = {.data = NULL}, .f = NULL};
     Reader rmodels;
-    if (raw) {
-      reader_raw_init(&rmodels, &*models);
+    if (sidecar_file != NULL) {
+      success = sidecar_load(&smodels, &rmodels, &*models, &*sidecar_file,
+                             HistoryLog2, (flags & FLAGS_VERBOSE) != 0);
     } else {
-      success = reader_gkey_init(&rmodels, HistoryLog2, &*models);
+      success = mem_reader_init(&rmodels, &bmodels, &*models, raw,
+                                "model data", model_file);
     }
 
     if (success && index) {
       Reader rindex;
-      if (raw) {
-        reader_raw_init(&rindex, &*index);
-      } else {
-        success = reader_gkey_init(&rindex, HistoryLog2, &*index);
-      }
+      success = mem_reader_init(&rindex, &bindex, &*index, raw, "index",
+                                index_file ? &*index_file : "stdin");
 
-      if (success && out) {
-        success = choc_to_obj(&rindex, &rmodels, &*out, first, last, name,
-                              data_start, mtl_file, thick, flags);
+      if (success && (nout > 0 || output_dir)) {
+        success = choc_to_obj(&rindex, &rmodels, nout, out, output_dir,
+                              first, last, name, data_start, mtl_file, thick,
+                              jobs, NULL, flags);
         reader_destroy(&rindex);
       }
 
       reader_destroy(&rmodels);
     }
 
+    file_buffer_free(&bindex);
+    file_buffer_free(&bmodels);
+    sidecar_free(&smodels);
+
     if (success && time)
     {
       printf("Time taken: %.2f seconds\n",
@@ -167,27 +396,240 @@ static bool process_file(const char * const model_file,
     fclose(&*index);
   }
 
-  if (out != NULL && out != stdout) {
-    if (flags & FLAGS_VERBOSE)
-      puts("Closing output file");
-
-    if (fclose(&*out)) {
-      fprintf(stderr, "Failed to close output file '%s': %s\n",
-                      STRING_OR_NULL(output_file), strerror(errno));
+  for (int v = 0; v < nout; ++v) {
+    if ((out[v].out != stdout) &&
+        !close_output_file(out[v].out, out_names[v], flags)) {
       success = false;
     }
   }
 
   /* Delete malformed output unless debugging is enabled or
      it may actually be the index (still intact) */
-  if (!success && !(flags & FLAGS_VERBOSE) && out != NULL && out != stdout &&
-      output_file) {
-    remove(&*output_file);
+  if (!success && !(flags & FLAGS_VERBOSE)) {
+    for (int v = 0; v < nout; ++v) {
+      if (out[v].out != stdout) {
+        remove(out_names[v]);
+      }
+    }
+  }
+
+  return success;
+}
+
+static void load_map_file(void * const arg, int const job)
+{
+  MapSet *const set = arg;
+  assert(set != NULL);
+  assert(job >= 0);
+  assert(job < MapFile_Count);
+
+  MapFile *const file = set->files + job;
+  _Optional FILE *const f = fopen(file->path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to open %s file '%s': %s\n",
+            file->type, file->path, strerror(errno));
+    return;
+  }
+
+  file->success = mem_reader_init(&file->r, &file->fb, &*f, set->raw,
+                                  file->type, file->path);
+  fclose(&*f);
+}
+
+static bool make_map_file(MapFile * const file, const char * const type,
+                          const char * const maps_dir,
+                          const char * const leaf, int const map)
+{
+  assert(file != NULL);
+  assert(type != NULL);
+  assert(maps_dir != NULL);
+  assert(leaf != NULL);
+
+  *file = (MapFile){.type = type, .fb = {.data = NULL}, .success = false};
+
+  int const len = map >= 0 ?
+    snprintf(file->path, sizeof(file->path), "%s%c%s%X", maps_dir,
+             PATH_SEPARATOR, leaf, (unsigned int)map) :
+    snprintf(file->path, sizeof(file->path), "%s%c%s", maps_dir,
+             PATH_SEPARATOR, leaf);
+
+  if ((len < 0) || ((size_t)len >= sizeof(file->path))) {
+    fprintf(stderr, "Path of %s file in '%s' is too long\n", type, maps_dir);
+    return false;
+  }
+  return true;
+}
+
+static bool process_map(Reader * const index, Reader * const models,
+                        const char * const output_file,
+                        const int first, const int last,
+                        _Optional const char * const name,
+                        const long int data_start,
+                        const char * const mtl_file,
+                        double const thick, const int jobs,
+                        SharedObjects * const shared,
+                        const unsigned int flags)
+{
+  assert(index != NULL);
+  assert(models != NULL);
+  assert(output_file != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  OutputVariant out;
+  char out_name[FILENAME_MAX];
+  if (!open_variant(&out, &out_name, output_file, NULL,
+                    flags & FLAGS_OUTPUT_STYLE, flags)) {
+    return false;
+  }
+
+  bool success = choc_to_obj(index, models, 1, &out, NULL, first, last,
+                             name, data_start, mtl_file, thick, jobs, shared,
+                             flags);
+
+  if (!close_output_file(out.out, out_name, flags)) {
+    success = false;
+  }
+
+  /* Delete malformed output unless debugging is enabled */
+  if (!success && !(flags & FLAGS_VERBOSE)) {
+    remove(out_name);
+  }
+
+  return success;
+}
+
+static bool process_map_set(const char * const maps_dir,
+                            const char * const output_file,
+                            const int first, const int last,
+                            _Optional const char * const name,
+                            const char * const mtl_file,
+                            double const thick, const int jobs,
+                            const unsigned int flags, const bool time,
+                            const bool raw)
+{
+  assert(maps_dir != NULL);
+  assert(output_file != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  _Optional MapSet *const set = malloc(sizeof(*set));
+  if (set == NULL) {
+    fprintf(stderr, "Failed to allocate memory for map set\n");
+    return false;
+  }
+
+  /* The common model data is in Land; each map's extra model data
+     is in LandExN and its index is in Things.Obj3DN. */
+  set->raw = raw;
+  bool success = make_map_file(set->files + MapFile_Land, "model data",
+                               maps_dir, "Land", -1);
+
+  char things[sizeof("Things.Obj3D")];
+  sprintf(things, "Things%cObj3D", PATH_SEPARATOR);
+
+  for (int m = 0; success && (m < NumMaps); ++m) {
+    success = make_map_file(set->files + MapFile_LandEx + m, "model data",
+                            maps_dir, "LandEx", m) &&
+              make_map_file(set->files + MapFile_Obj3D + m, "index",
+                            maps_dir, things, m);
+  }
+
+  const clock_t start_time = time ? clock() : 0;
+
+  if (success) {
+    if (flags & FLAGS_VERBOSE)
+      printf("Loading map set '%s'\n", maps_dir);
+
+    /* Decompressing the files is slow, so it's done in parallel, but
+       diagnostic output is only produced serially. */
+    jobs_run((flags & FLAGS_VERBOSE) ? 1 : jobs, MapFile_Count,
+             load_map_file, &*set);
+
+    for (int f = 0; f < MapFile_Count; ++f) {
+      if (!set->files[f].success) {
+        success = false;
+      }
+    }
+  }
+
+  if (success) {
+    /* Objects in the common model data are converted once for all maps.
+       Each map's index addresses its extra model data as if it were
+       appended to the common model data. */
+    Reader *indices[NumMaps];
+    for (int m = 0; m < NumMaps; ++m) {
+      indices[m] = &set->files[MapFile_Obj3D + m].r;
+    }
+
+    MapFile *const land = set->files + MapFile_Land;
+    long int const land_size = (long int)file_buffer_get_size(&land->fb);
+
+    _Optional SharedObjects *const shared = shared_objects_create(
+      indices, NumMaps, &land->r, land_size, first, last, name, thick, jobs,
+      flags);
+
+    if (shared == NULL) {
+      success = false;
+    }
+
+    for (int m = 0; success && (m < NumMaps); ++m) {
+      char tag[2], map_output_file[FILENAME_MAX];
+      sprintf(tag, "%X", (unsigned int)m);
+      success = make_output_name(&map_output_file, output_file, tag) &&
+                process_map(indices[m], &set->files[MapFile_LandEx + m].r,
+                            map_output_file, first, last, name, land_size,
+                            mtl_file, thick, jobs, &*shared, flags);
+    }
+
+    shared_objects_destroy(shared);
+  }
+
+  for (int f = 0; f < MapFile_Count; ++f) {
+    MapFile *const file = set->files + f;
+    if (file->success) {
+      reader_destroy(&file->r);
+    }
+    file_buffer_free(&file->fb);
+  }
+  free(set);
+
+  if (success && time)
+  {
+    printf("Time taken: %.2f seconds\n",
+           (double)(clock_t)(clock() - start_time) / CLOCKS_PER_SEC);
   }
 
   return success;
 }
 
+static bool parse_variants(const char * const list,
+                           unsigned int * const variants)
+{
+  assert(list != NULL);
+  assert(variants != NULL);
+
+  /* Comma-separated names of output styles */
+  const char *start = list;
+  do {
+    size_t const len = strcspn(start, ",");
+    int v;
+    for (v = 0; v < NumVariantStyles; ++v) {
+      if ((strlen(variant_styles[v].name) == len) &&
+          !strncmp(start, variant_styles[v].name, len)) {
+        break;
+      }
+    }
+    if (v == NumVariantStyles) {
+      fprintf(stderr, "Unrecognised output variant '%.*s'\n", (int)len,
+              start);
+      return false;
+    }
+    *variants |= 1u << v;
+    start += len;
+  } while (*start++ != '\0');
+
+  return true;
+}
+
 static int syntax_msg(FILE * const f, const char * const path)
 {
   assert(f != NULL);
@@ -196,11 +638,14 @@ static int syntax_msg(FILE * const f, const char * const path)
   const char * const leaf = strtail(path, PATH_SEPARATOR, 1);
   fprintf(f,
           "usage: %s [switches] <model-file> [<index-file> [<output-file>]]\n"
+          "   or: %s -maps [switches] <maps-dir> <output-file>\n"
           "If no index file is specified, it reads from stdin.\n"
           "If no output file is specified, it writes to stdout.\n"
+          "In map-set mode, the map number replaces any '#' in the output file\n"
+          "name, or else it is appended. Likewise for output variant names.\n"
           "If a material library file is specified then a reference to it will be\n"
           "inserted in the output. This file is not created, read or written.\n",
-          leaf);
+          leaf, leaf);
 
   fputs("Switches (names may be abbreviated):\n"
         "  -help               Display this text\n"
@@ -208,12 +653,16 @@ static int syntax_msg(FILE * const f, const char * const path)
         "  -list               List objects instead of converting them\n"
         "  -summary            Summarize objects instead of converting them\n"
         "  -index N            Object number to convert or list (default is all)\n"
+        "  -jobs N             Number of threads converting objects (default 1)\n"
         "  -first N            First object number to convert or list\n"
         "  -last N             Last object number to convert or list\n"
+        "  -maps               Convert every map in an Extra Missions directory\n"
         "  -name <name>        Object name to convert or list (default is all)\n"
         "  -offset N           Signed byte offset to start of model data in file\n"
+        "  -outdir <name>      Write each object to a file in the named directory\n"
         "  -outfile <name>     Write output to the named file instead of stdout\n"
         "  -raw                Model and index files are uncompressed raw data\n"
+        "  -sidecar <name>     Keep decompressed model data in the named file\n"
         "  -thick N            Line thickness (N=0..100, default 0)\n"
         "  -time               Show the total time for each file processed\n"
         "  -verbose or -debug  Emit debug information (and keep bad output)\n", f);
@@ -223,13 +672,19 @@ static int syntax_msg(FILE * const f, const char * const path)
         "  -human              Output readable material names\n"
         "  -false              Assign false colours for visualization\n"
         "  -simple             Output simplified models\n"
+        "  -lod                Output simplified and complex models together\n"
         "  -unused             Include unused vertices in the output\n"
         "  -duplicate          Include duplicate vertices in the output\n"
+        "  -pool               Share identical vertices between objects\n"
         "  -negative           Output negative vertex indices\n"
         "  -clip               Clip overlapping coplanar polygons\n"
         "  -flip               Flip back-facing polygons coplanar with z=0\n"
         "  -fans               Split complex polygons into triangle fans\n"
-        "  -strips             Split complex polygons into triangle strips\n", f);
+        "  -strips             Split complex polygons into triangle strips\n"
+        "  -sort               Sort faces by material within each group\n"
+        "  -rgb                Output vertex colours instead of materials\n"
+        "  -variants <list>    Output several styles, each to its own file\n"
+        "                      (any of plain,fans,strips,negative)\n", f);
 
   return EXIT_FAILURE;
 }
@@ -260,14 +715,15 @@ int real_main(int argc, const char *argv[])
 int main(int argc, const char *argv[])
 #endif
 {
-  int n, first = -1, last = -1;
+  int n, first = -1, last = -1, jobs = 1;
   long int data_start = 0;
-  unsigned int flags = 0;
+  unsigned int flags = 0, variants = 0;
   double thick = 0.0;
   _Optional const char *name = NULL;
-  bool time = false, raw = false;
+  bool time = false, raw = false, maps = false;
   int rtn = EXIT_SUCCESS;
-  _Optional const char *output_file = NULL, *index_file = NULL;
+  _Optional const char *output_file = NULL, *index_file = NULL,
+                       *sidecar_file = NULL, *output_dir = NULL;
   const char *model_file, *mtl_file = "sf3k.mtl";
 
   assert(argc > 0);
@@ -320,6 +776,13 @@ int main(int argc, const char *argv[])
         return syntax_msg(stderr, argv[0]);
       }
       first = last = (int)objnum;
+    } else if (is_switch(opt, "jobs", 1)) {
+      /* Number of threads to use for conversion was specified */
+      long int njobs;
+      if (!get_long_arg("jobs", &njobs, 1, JobsMaxThreads, argc, argv, ++n)) {
+        return syntax_msg(stderr, argv[0]);
+      }
+      jobs = (int)njobs;
     } else if (is_switch(opt, "last", 2)) {
       /* Last object number to convert was specified */
       long int objnum;
@@ -330,6 +793,12 @@ int main(int argc, const char *argv[])
     } else if (is_switch(opt, "list", 2)) {
       /* List contents of file */
       flags |= FLAGS_LIST;
+    } else if (is_switch(opt, "lod", 2)) {
+      /* Enable output of simplified objects alongside complex objects */
+      flags |= FLAGS_LEVELS_OF_DETAIL;
+    } else if (is_switch(opt, "maps", 2)) {
+      /* Enable conversion of a set of maps */
+      maps = true;
     } else if (is_switch(opt, "mtllib", 1)) {
       /* Materials library file path was specified */
       if (++n >= argc || argv[n][0] == '-') {
@@ -361,12 +830,36 @@ int main(int argc, const char *argv[])
         return syntax_msg(stderr, argv[0]);
       }
       output_file = argv[n];
+    } else if (is_switch(opt, "outdir", 4)) {
+      /* Output directory path was specified (checked after outfile so
+         that abbreviations such as '-out' keep their meaning) */
+      if (++n >= argc || argv[n][0] == '-') {
+        fputs("Missing output directory name\n", stderr);
+        return syntax_msg(stderr, argv[0]);
+      }
+      output_dir = argv[n];
+    } else if (is_switch(opt, "pool", 2)) {
+      /* Enable sharing of vertices between objects */
+      flags |= FLAGS_VERTEX_POOL;
     } else if (is_switch(opt, "raw", 1)) {
       /* Enable raw input */
       raw = true;
+    } else if (is_switch(opt, "rgb", 2)) {
+      /* Enable output of colours with vertices */
+      flags |= FLAGS_VERTEX_COLOURS;
     } else if (is_switch(opt, "simple", 2)) {
       /* Enable output of simplified objects */
       flags |= FLAGS_SIMPLE;
+    } else if (is_switch(opt, "sidecar", 3)) {
+      /* Sidecar file path was specified */
+      if (++n >= argc || argv[n][0] == '-') {
+        fputs("Missing sidecar file name\n", stderr);
+        return syntax_msg(stderr, argv[0]);
+      }
+      sidecar_file = argv[n];
+    } else if (is_switch(opt, "sort", 2)) {
+      /* Enable sorting of primitives by material */
+      flags |= FLAGS_SORT_MATERIALS;
     } else if (is_switch(opt, "strips", 2)) {
       /* Enable decomposition of complex polygons into triangle strips */
       flags |= FLAGS_TRIANGLE_STRIPS;
@@ -384,6 +877,15 @@ int main(int argc, const char *argv[])
     } else if (is_switch(opt, "unused", 1)) {
       /* Enable output of unused vertices */
       flags |= FLAGS_UNUSED;
+    } else if (is_switch(opt, "variants", 2)) {
+      /* Names of output styles were specified */
+      if (++n >= argc || argv[n][0] == '-') {
+        fputs("Missing output variant names\n", stderr);
+        return syntax_msg(stderr, argv[0]);
+      }
+      if (!parse_variants(argv[n], &variants)) {
+        return syntax_msg(stderr, argv[0]);
+      }
     } else if (is_switch(opt, "verbose", 1)) {
       /* Enable debugging output */
       flags |= FLAGS_VERBOSE;
@@ -401,20 +903,74 @@ int main(int argc, const char *argv[])
     first = 0;
   }
 
+  if (raw && (sidecar_file != NULL)) {
+    fputs("Cannot use a sidecar file with uncompressed input\n", stderr);
+    return EXIT_FAILURE;
+  }
+
   if ((flags & FLAGS_TRIANGLE_STRIPS) && (flags & FLAGS_TRIANGLE_FANS)) {
     fputs("Cannot split polygons into both triangle fans and strips\n", stderr);
     return EXIT_FAILURE;
   }
 
-  /* The model data file must follow any switches */
+  if ((flags & FLAGS_SIMPLE) && (flags & FLAGS_LEVELS_OF_DETAIL)) {
+    fputs("Cannot output only simplified models with both levels of "
+          "detail\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  if (maps && (flags & (FLAGS_LIST|FLAGS_SUMMARY))) {
+    fputs("Cannot list or summarize objects in map-set mode\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  if ((flags & FLAGS_SORT_MATERIALS) && (flags & FLAGS_FALSE_COLOUR)) {
+    fputs("Cannot sort faces by material when assigning false colours\n",
+          stderr);
+    return EXIT_FAILURE;
+  }
+
+  if ((flags & FLAGS_VERTEX_COLOURS) &&
+      (flags & (FLAGS_VERTEX_POOL|FLAGS_UNUSED))) {
+    fputs("Cannot output vertex colours when sharing vertices between "
+          "objects or including unused vertices\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  if ((flags & FLAGS_VERTEX_POOL) && (flags & FLAGS_DUPLICATE)) {
+    fputs("Cannot include duplicate vertices when sharing vertices between "
+          "objects\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  if ((variants != 0) && (flags & FLAGS_OUTPUT_STYLE)) {
+    fputs("Cannot specify an output style as well as output variants\n",
+          stderr);
+    return EXIT_FAILURE;
+  }
+
+  if ((variants != 0) && (maps || (output_dir != NULL) ||
+                          (flags & (FLAGS_LIST|FLAGS_SUMMARY)))) {
+    fputs("Cannot write output variants in map-set, output directory, "
+          "list or summary mode\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  if (maps && ((sidecar_file != NULL) || (data_start != 0))) {
+    fputs("Cannot use a sidecar file or offset in map-set mode\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  /* The model data file (or map set directory) must follow any switches */
   if (argc < n + 1) {
-    fprintf(stderr, "Must specify a model data file\n");
+    fprintf(stderr, maps ? "Must specify a map set directory\n" :
+                           "Must specify a model data file\n");
     return syntax_msg(stderr, argv[0]);
   }
   model_file = argv[n++];
 
   /* If an index file was specified, it should follow the switches */
-  if (n < argc) {
+  if ((n < argc) && !maps) {
     index_file = argv[n++];
   }
 
@@ -428,13 +984,26 @@ int main(int argc, const char *argv[])
     output_file = argv[n++];
   }
 
-  if ((flags & (FLAGS_LIST|FLAGS_SUMMARY)) && (output_file != NULL)) {
+  if ((flags & (FLAGS_LIST|FLAGS_SUMMARY)) &&
+      ((output_file != NULL) || (output_dir != NULL))) {
     fputs("Cannot specify an output file in list or summary mode\n", stderr);
     return EXIT_FAILURE;
   }
 
+  if ((output_dir != NULL) && ((output_file != NULL) || maps)) {
+    fputs("Cannot specify an output directory with an output file or "
+          "in map-set mode\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  if ((output_dir != NULL) && (flags & FLAGS_VERTEX_POOL)) {
+    fputs("Cannot share vertices between objects in separate files\n",
+          stderr);
+    return EXIT_FAILURE;
+  }
+
   /* Ensure that OBJ output isn't mixed up with other text on stdout */
-  if ((output_file == NULL) &&
+  if ((output_file == NULL) && (output_dir == NULL) &&
       !(flags & (FLAGS_LIST|FLAGS_SUMMARY)) &&
       (time || (flags & FLAGS_VERBOSE))) {
     fputs("Must specify an output file in verbose/timer mode\n", stderr);
@@ -446,13 +1015,30 @@ int main(int argc, const char *argv[])
     return syntax_msg(stderr, argv[0]);
   }
 
+  if (maps && (output_file == NULL)) {
+    fputs("Must specify an output file name in map-set mode\n", stderr);
+    return syntax_msg(stderr, argv[0]);
+  }
+
+  if ((variants != 0) && (output_file == NULL)) {
+    fputs("Must specify an output file name for output variants\n", stderr);
+    return syntax_msg(stderr, argv[0]);
+  }
+
   if (flags & FLAGS_VERBOSE) {
     printf("Chocks Away to Wavefront obj convertor, "VERSION_STRING"\n"
            "Copyright (C) 2018, Christopher Bazley\n");
   }
 
-  if (!process_file(model_file, index_file, output_file, first, last, name,
-                    data_start, mtl_file, thick, flags, time, raw)) {
+  if (maps) {
+    if (!process_map_set(model_file, &*output_file, first, last, name,
+                         mtl_file, thick, jobs, flags, time, raw)) {
+      rtn = EXIT_FAILURE;
+    }
+  } else if (!process_file(model_file, index_file, output_file, output_dir,
+                           sidecar_file, first, last, name,
+                           data_start, mtl_file, thick, jobs, variants,
+                           flags, time, raw)) {
     rtn = EXIT_FAILURE;
   }
 
@@ -95,3 +95,25 @@ const char *get_colour_name(const int colour)
   assert((size_t)colour < ARRAY_SIZE(colour_names));
   return colour_names[colour];
 }
+
+void get_colour_rgb(const int colour, double (* const rgb)[3])
+{
+  assert(colour >= 0);
+  assert(colour < 256);
+  assert(rgb != NULL);
+
+  /* In the default 256-colour palette, the two least significant bits of
+     every component are the tint and the other two bits are taken from
+     the colour number. */
+  int const tint = colour & 3;
+  int const red = tint | ((colour & 0x04) ? 4 : 0) |
+                  ((colour & 0x10) ? 8 : 0);
+  int const green = tint | ((colour & 0x20) ? 4 : 0) |
+                    ((colour & 0x40) ? 8 : 0);
+  int const blue = tint | ((colour & 0x08) ? 4 : 0) |
+                   ((colour & 0x80) ? 8 : 0);
+
+  (*rgb)[0] = red / 15.0;
+  (*rgb)[1] = green / 15.0;
+  (*rgb)[2] = blue / 15.0;
+}
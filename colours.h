@@ -9,4 +9,8 @@
 
 const char *get_colour_name(int colour);
 
+/* Get the red, green and blue components (in the range 0..1) of a colour
+   number in the RISC OS 256-colour palette, as used by the game. */
+void get_colour_rgb(int colour, double (*rgb)[3]);
+
 #endif /* COLOURS_H */
@@ -0,0 +1,217 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Duplicate vertex detection
+ *  Copyright (C) 2018 Christopher Bazley
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public Licence as published by
+ *  the Free Software Foundation; either version 2 of the Licence, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public Licence for more details.
+ *
+ *  You should have received a copy of the GNU General Public Licence
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* ISO library header files */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* 3dObjLib headers */
+#include "Coord.h"
+#include "Vertex.h"
+
+/* Local header files */
+#include "duplicates.h"
+#include "arena.h"
+#include "misc.h"
+
+/* Vertices are binned into cubic cells of this size, which must be greater
+   than the tolerance of coord_equal. Two vertices that compare equal must
+   then be in the same cell or in adjacent cells. The tolerance is defined
+   by 3dObjLib (not as a constant), so it is checked at run time: see
+   is_cell_size_valid. */
+#define CELL_SIZE (1.0)
+
+typedef struct {
+  long long int key[3];
+  int count; /* 0 if the hash table entry is empty */
+} Cell;
+
+typedef struct {
+  Cell *cells;
+  size_t mask;
+} CellTable;
+
+static void get_cell_key(Coord (*const coords)[3],
+                         long long int (*const key)[3])
+{
+  assert(coords != NULL);
+  assert(key != NULL);
+
+  for (size_t dim = 0; dim < ARRAY_SIZE(*key); ++dim) {
+    /* Round towards negative infinity, like floor */
+    Coord const scaled = (*coords)[dim] / CELL_SIZE;
+    long long int k = (long long int)scaled;
+    if (k > scaled) {
+      --k;
+    }
+    (*key)[dim] = k;
+  }
+}
+
+static Cell *find_cell(CellTable const *const table,
+                       long long int (*const key)[3])
+{
+  assert(table != NULL);
+  assert(key != NULL);
+
+  uint64_t hash = 14695981039346656037u; /* 64-bit FNV-1a offset basis */
+  for (size_t dim = 0; dim < ARRAY_SIZE(*key); ++dim) {
+    hash ^= (uint64_t)(*key)[dim];
+    hash *= 1099511628211u;
+  }
+
+  /* Linear probing finds either the matching cell or an empty one */
+  size_t i = (size_t)(hash ^ (hash >> 32)) & table->mask;
+  for (;;) {
+    Cell *const cell = table->cells + i;
+    if (!cell->count || ((cell->key[0] == (*key)[0]) &&
+                         (cell->key[1] == (*key)[1]) &&
+                         (cell->key[2] == (*key)[2]))) {
+      return cell;
+    }
+    i = (i + 1) & table->mask;
+  }
+}
+
+static bool has_near_vertex(CellTable const *const table,
+                            long long int (*const key)[3])
+{
+  assert(table != NULL);
+  assert(key != NULL);
+
+  int count = 0;
+  for (int dx = -1; dx <= 1; ++dx) {
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dz = -1; dz <= 1; ++dz) {
+        long long int near[3] = {
+          (*key)[0] + dx, (*key)[1] + dy, (*key)[2] + dz
+        };
+        count += find_cell(table, &near)->count;
+      }
+    }
+  }
+
+  /* The vertex itself is always counted */
+  return count > 1;
+}
+
+/* Check that coordinates which differ by the cell size (or more) never
+   compare equal, at the largest magnitude of any coordinate in case the
+   tolerance of coord_equal is relative rather than absolute. */
+static bool is_cell_size_valid(Coord const max_magnitude)
+{
+  assert(max_magnitude >= 0);
+  return !coord_equal(max_magnitude, max_magnitude + CELL_SIZE) &&
+         !coord_equal(-max_magnitude, -max_magnitude - CELL_SIZE);
+}
+
+static bool may_have_duplicates(VertexArray *const varray,
+                                Arena *const arena)
+{
+  assert(varray != NULL);
+  assert(arena != NULL);
+
+  int const nvertices = vertex_array_get_num_vertices(varray);
+  if (nvertices < 2) {
+    return false;
+  }
+
+  /* Keep the load factor at or below one half */
+  size_t size = 4;
+  while (size < (size_t)nvertices * 2) {
+    size *= 2;
+  }
+
+  CellTable table = {.cells = NULL, .mask = size - 1};
+  _Optional Cell *const cells = arena_alloc(arena, size * sizeof(*cells));
+  if (cells == NULL) {
+    return true; /* fall back to comparing every pair */
+  }
+  memset(&*cells, 0, size * sizeof(*cells));
+  table.cells = &*cells;
+
+  Coord max_magnitude = 0;
+  for (int v = 0; v < nvertices; ++v) {
+    if (!vertex_array_is_used(varray, v)) {
+      continue;
+    }
+    _Optional Coord (*coords)[3] = vertex_array_get_coords(varray, v);
+    if (!coords) {
+      continue;
+    }
+    for (size_t dim = 0; dim < ARRAY_SIZE(*coords); ++dim) {
+      Coord const magnitude = (*coords)[dim] < 0 ? -(*coords)[dim] :
+                                                   (*coords)[dim];
+      if (magnitude > max_magnitude) {
+        max_magnitude = magnitude;
+      }
+    }
+
+    long long int key[3];
+    get_cell_key(&*coords, &key);
+    Cell *const cell = find_cell(&table, &key);
+    if (!cell->count) {
+      for (size_t dim = 0; dim < ARRAY_SIZE(key); ++dim) {
+        cell->key[dim] = key[dim];
+      }
+    }
+    ++cell->count;
+  }
+
+  if (!is_cell_size_valid(max_magnitude)) {
+    DEBUGF("Cell size %g is within the tolerance of coord_equal at %g\n",
+           CELL_SIZE, max_magnitude);
+    return true; /* fall back to comparing every pair */
+  }
+
+  bool found = false;
+  for (int v = 0; v < nvertices && !found; ++v) {
+    if (!vertex_array_is_used(varray, v)) {
+      continue;
+    }
+    _Optional Coord (*coords)[3] = vertex_array_get_coords(varray, v);
+    if (!coords) {
+      continue;
+    }
+    long long int key[3];
+    get_cell_key(&*coords, &key);
+    found = has_near_vertex(&table, &key);
+  }
+
+  DEBUGF("Spatial hash of %d vertices %s duplicates\n", nvertices,
+         found ? "may contain" : "has no");
+  return found;
+}
+
+int find_duplicates(VertexArray *const varray, Arena *const arena,
+                    bool const verbose)
+{
+  assert(varray != NULL);
+  assert(arena != NULL);
+  assert(is_cell_size_valid(0));
+
+  /* Keep verbose output identical to that of the library function */
+  if (!verbose && !may_have_duplicates(varray, arena)) {
+    return 0;
+  }
+  return vertex_array_find_duplicates(varray, verbose);
+}
@@ -0,0 +1,28 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Duplicate vertex detection
+ *  Copyright (C) 2018 Christopher Bazley
+ */
+
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+/* ISO C library headers */
+#include <stdbool.h>
+
+/* 3dObjLib headers */
+#include "Vertex.h"
+
+/* Local headers */
+#include "arena.h"
+
+/* Equivalent to vertex_array_find_duplicates, except that the comparison
+   of every pair of used vertices is skipped if a spatial hash shows that
+   no used vertex has another used vertex nearby. Only objects without any
+   near pair of vertices benefit: otherwise (or if 'verbose' is true) every
+   pair is still compared by the library. The spatial hash is allocated
+   from the given arena.
+   Returns the number of duplicates found, or a negative value on failure. */
+int find_duplicates(VertexArray *varray, Arena *arena, bool verbose);
+
+#endif /* DUPLICATES_H */
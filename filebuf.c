@@ -0,0 +1,178 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Whole file contents in memory
+ *  Copyright (C) 2018 Christopher Bazley
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public Licence as published by
+ *  the Free Software Foundation; either version 2 of the Licence, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public Licence for more details.
+ *
+ *  You should have received a copy of the GNU General Public Licence
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef USE_MMAP
+/* Required for fileno when compiling for strict ISO C */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* ISO library header files */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef USE_MMAP
+/* POSIX header files */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+/* StreamLib headers */
+#include "Reader.h"
+#include "ReaderRaw.h"
+
+/* Local header files */
+#include "filebuf.h"
+#include "misc.h"
+
+enum {
+  InitialBufferSize = 1 << 16
+};
+
+bool file_buffer_read(FileBuffer * const fb, Reader * const r)
+{
+  assert(fb != NULL);
+  assert(r != NULL);
+
+  _Optional unsigned char *data = NULL;
+  size_t size = 0, capacity = 0, n;
+
+  do {
+    if (size == capacity) {
+      size_t const new_capacity = capacity ? capacity * 2 :
+                                             InitialBufferSize;
+      _Optional unsigned char *const new_data = realloc(data, new_capacity);
+      if (new_data == NULL) {
+        free(data);
+        return false;
+      }
+      data = new_data;
+      capacity = new_capacity;
+    }
+    n = reader_fread(&*data + size, 1, capacity - size, r);
+    size += n;
+  } while (n > 0);
+
+  if (reader_ferror(r)) {
+    free(data);
+    return false;
+  }
+
+  DEBUGF("Read %zu bytes into a heap block\n", size);
+  *fb = (FileBuffer){.data = data, .size = size, .mapped = false};
+  return true;
+}
+
+#ifdef USE_MMAP
+static bool map_file(FileBuffer * const fb, FILE * const f)
+{
+  assert(fb != NULL);
+  assert(f != NULL);
+
+  /* Only whole regular files can be mapped; anything else (such as
+     the standard input stream) must be read. */
+  if (ftell(f) != 0) {
+    return false;
+  }
+
+  int const fd = fileno(f);
+  struct stat st;
+  if ((fd < 0) || fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+      (st.st_size <= 0) || ((uintmax_t)st.st_size > SIZE_MAX)) {
+    return false;
+  }
+
+  size_t const size = (size_t)st.st_size;
+  void *const data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  DEBUGF("Mapped %zu bytes at %p\n", size, data);
+  *fb = (FileBuffer){.data = (unsigned char *)data, .size = size,
+                     .mapped = true};
+  return true;
+}
+#endif /* USE_MMAP */
+
+bool file_buffer_map(FileBuffer * const fb, FILE * const f)
+{
+  assert(fb != NULL);
+  assert(f != NULL);
+
+#ifdef USE_MMAP
+  return map_file(fb, f);
+#else
+  NOT_USED(fb);
+  NOT_USED(f);
+  return false;
+#endif
+}
+
+bool file_buffer_load(FileBuffer * const fb, FILE * const f)
+{
+  assert(fb != NULL);
+  assert(f != NULL);
+
+  if (file_buffer_map(fb, f)) {
+    return true;
+  }
+
+  Reader r;
+  reader_raw_init(&r, f);
+  bool const success = file_buffer_read(fb, &r);
+  reader_destroy(&r);
+  return success;
+}
+
+void const *file_buffer_get_data(FileBuffer const * const fb)
+{
+  assert(fb != NULL);
+  assert(fb->data != NULL);
+  return &*fb->data;
+}
+
+size_t file_buffer_get_size(FileBuffer const * const fb)
+{
+  assert(fb != NULL);
+  return fb->size;
+}
+
+void file_buffer_free(FileBuffer * const fb)
+{
+  assert(fb != NULL);
+
+  if (fb->data == NULL) {
+    return;
+  }
+
+#ifdef USE_MMAP
+  if (fb->mapped) {
+    munmap(&*fb->data, fb->size);
+    fb->data = NULL;
+    return;
+  }
+#endif
+
+  free(fb->data);
+  fb->data = NULL;
+}
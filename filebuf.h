@@ -0,0 +1,47 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Whole file contents in memory
+ *  Copyright (C) 2018 Christopher Bazley
+ */
+
+#ifndef FILEBUF_H
+#define FILEBUF_H
+
+/* ISO C library headers */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* StreamLib headers */
+#include "Reader.h"
+
+#if !defined(USE_OPTIONAL) && !defined(_Optional)
+#define _Optional
+#endif
+
+typedef struct {
+  _Optional unsigned char *data;
+  size_t size;
+  bool mapped;
+} FileBuffer;
+
+/* Get the contents of a file from its current position to the end, mapping
+   it into memory if possible or else reading it into a heap block. */
+bool file_buffer_load(FileBuffer *fb, FILE *f);
+
+/* Map the whole of a file into memory, if possible. Returns false without
+   reading the file if it cannot be mapped (including on systems that don't
+   support mapping). The mapping remains valid after the file is closed. */
+bool file_buffer_map(FileBuffer *fb, FILE *f);
+
+/* Get all of the data that can be read from a stream (for example, by
+   decompressing it) into a heap block. */
+bool file_buffer_read(FileBuffer *fb, Reader *r);
+
+void const *file_buffer_get_data(FileBuffer const *fb);
+
+size_t file_buffer_get_size(FileBuffer const *fb);
+
+void file_buffer_free(FileBuffer *fb);
+
+#endif /* FILEBUF_H */
@@ -19,7 +19,10 @@
  */
 
 /* ISO library header files */
+#include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* 3dObjLib headers */
 #include "Vertex.h"
@@ -32,6 +35,44 @@
 #include "findnorm.h"
 #include "misc.h"
 
+/* Maximum distance of a vertex from the plane (or outside the bounding box)
+   of a polygon for the polygon to be considered as a potential container.
+   This is much looser than the exact tests applied afterwards, so no
+   container can be missed. */
+#define PLANE_TOLERANCE (1.0)
+
+enum {
+  InitialIndexSize = 32,
+  MaxExactCoord = 1 << 19, /* Keeps exact calculations within 64 bits */
+  MaxExactSides = 16
+};
+
+static bool is_container(const VertexArray *const varray,
+                         Primitive *const backp, Primitive *const frontp)
+{
+  /* Find the two-dimensional plane in which to check the two primitives
+     for overlap (returns false if the back primitive is a point or line). */
+  Plane plane;
+  if (!primitive_find_plane(backp, varray, &plane)) {
+    DEBUGF("Skipping %p: no plane\n", (void *)backp);
+    return false;
+  }
+
+  /* Check that both primitives occupy the same plane */
+  if (!primitive_coplanar(backp, frontp, varray)) {
+    DEBUGF("Skipping %p: not coplanar\n", (void *)backp);
+    return false;
+  }
+
+  /* Check that the front primitive is completely within the back polygon */
+  if (!primitive_contains(backp, frontp, varray, plane)) {
+    return false;
+  }
+
+  DEBUGF("Found container %p\n", (void *)backp);
+  return true;
+}
+
 static _Optional Primitive *find_container_in_group(
                     const VertexArray *const varray, Primitive *const frontp,
                     const Group *const group, int back)
@@ -46,24 +87,8 @@ static _Optional Primitive *find_container_in_group(
     DEBUGF("Back primitive is %d (%p) in group %p\n", back, (void *)backp,
            (void *)group);
 
-    /* Find the two-dimensional plane in which to check the two primitives
-       for overlap (returns false if the back primitive is a point or line). */
-    Plane plane;
-    if (!primitive_find_plane(&*backp, varray, &plane)) {
-      DEBUGF("Skipping %p: no plane\n", (void *)backp);
-      continue;
-    }
-
-    /* Check that both primitives occupy the same plane */
-    if (!primitive_coplanar(&*backp, frontp, varray)) {
-      DEBUGF("Skipping %p: not coplanar\n", (void *)backp);
-      continue;
-    }
-
-    /* Check that the front primitive is completely within the back polygon */
-    if (primitive_contains(&*backp, frontp, varray, plane)) {
+    if (is_container(varray, &*backp, frontp)) {
       container = backp;
-      DEBUGF("Found container %p\n", (void *)container);
     }
   }
   return container;
@@ -71,11 +96,13 @@ static _Optional Primitive *find_container_in_group(
 
 static _Optional Primitive *find_container(VertexArray const * const varray,
                                            Group const * const groups,
+                                           int const first_group,
                                            int const group)
 {
   _Optional Primitive *container = NULL;
   assert(groups != NULL);
-  assert(group >= 0);
+  assert(first_group >= 0);
+  assert(group >= first_group);
 
   Group const * const front_group = groups + group;
   int const nprimitives = group_get_num_primitives(front_group);
@@ -95,7 +122,7 @@ static _Optional Primitive *find_container(VertexArray const * const varray,
     }
 
     /* Search for a containing polygon in previous groups. */
-    for (int bg = 0; (bg < group) && (container == NULL); ++bg) {
+    for (int bg = first_group; (bg < group) && (container == NULL); ++bg) {
       Group const * const back_group = groups + bg;
       DEBUGF("Searching previous group %d (%p)\n", bg, (void *)back_group);
 
@@ -107,14 +134,584 @@ static _Optional Primitive *find_container(VertexArray const * const varray,
   return container;
 }
 
-bool find_container_normal(VertexArray const * const varray,
+static bool get_bounds(VertexArray const * const varray,
+                       Primitive const * const p,
+                       Coord (*const min)[3], Coord (*const max)[3])
+{
+  assert(min != NULL);
+  assert(max != NULL);
+
+  int const nsides = primitive_get_num_sides(p);
+  for (int s = 0; s < nsides; ++s) {
+    _Optional Coord (*const coords)[3] =
+      vertex_array_get_coords(varray, primitive_get_side(p, s));
+    if (!coords) {
+      return false;
+    }
+    for (size_t dim = 0; dim < ARRAY_SIZE(*coords); ++dim) {
+      if ((s == 0) || ((*coords)[dim] < (*min)[dim])) {
+        (*min)[dim] = (*coords)[dim];
+      }
+      if ((s == 0) || ((*coords)[dim] > (*max)[dim])) {
+        (*max)[dim] = (*coords)[dim];
+      }
+    }
+  }
+  return nsides > 0;
+}
+
+static Coord get_distance(Coord (*const normal)[3], Coord (*const coords)[3])
+{
+  return ((*normal)[0] * (*coords)[0]) + ((*normal)[1] * (*coords)[1]) +
+         ((*normal)[2] * (*coords)[2]);
+}
+
+/* Convert a polygon's normal into a plane equation */
+static bool get_plane(VertexArray const * const varray,
+                      Primitive const * const p,
+                      Coord (*const normal)[3], Coord *const distance)
+{
+  assert(normal != NULL);
+  assert(distance != NULL);
+
+  Coord n[3] = {(*normal)[0], (*normal)[1], (*normal)[2]};
+  if (!vector_norm(&n, normal)) {
+    return false;
+  }
+
+  /* A polygon and its reverse share the same plane */
+  size_t major = 0;
+  for (size_t dim = 1; dim < ARRAY_SIZE(n); ++dim) {
+    Coord const a = (*normal)[dim] < 0 ? -(*normal)[dim] : (*normal)[dim];
+    Coord const b = (*normal)[major] < 0 ? -(*normal)[major] :
+                                           (*normal)[major];
+    if (a > b) {
+      major = dim;
+    }
+  }
+  if ((*normal)[major] < 0) {
+    vector_mul(normal, -1, normal);
+  }
+
+  _Optional Coord (*const coords)[3] =
+    vertex_array_get_coords(varray, primitive_get_side(p, 0));
+  if (!coords) {
+    return false;
+  }
+
+  *distance = get_distance(normal, &*coords);
+  return true;
+}
+
+static int find_plane(ContainerIndex * const index,
+                      Coord (*const normal)[3], Coord const distance,
+                      bool const any)
+{
+  assert(index != NULL);
+
+  for (int pl = 0; pl < index->nplanes; ++pl) {
+    ContainerPlane const *const plane = &index->planes[pl];
+    if (any ? plane->any :
+        (!plane->any && coord_equal(plane->distance, distance) &&
+         coord_equal(plane->normal[0], (*normal)[0]) &&
+         coord_equal(plane->normal[1], (*normal)[1]) &&
+         coord_equal(plane->normal[2], (*normal)[2]))) {
+      return pl;
+    }
+  }
+
+  if (index->nplanes == index->planes_size) {
+    int const new_size = index->planes_size ? index->planes_size * 2 :
+                                              InitialIndexSize;
+    _Optional ContainerPlane *const new_planes =
+      realloc(index->planes, sizeof(*new_planes) * (size_t)new_size);
+    if (new_planes == NULL) {
+      return -1;
+    }
+    index->planes = new_planes;
+    index->planes_size = new_size;
+  }
+
+  ContainerPlane *const plane = &index->planes[index->nplanes];
+  *plane = (ContainerPlane){.distance = distance, .any = any,
+                            .first = -1, .last = -1};
+  if (!any) {
+    for (size_t dim = 0; dim < ARRAY_SIZE(plane->normal); ++dim) {
+      plane->normal[dim] = (*normal)[dim];
+    }
+  }
+  return index->nplanes++;
+}
+
+/* Get the coordinates of a primitive's vertices as integers, if they are
+   small enough for exact calculations (as are those read from the file). */
+static int get_exact_coords(VertexArray const * const varray,
+                            Primitive const * const p,
+                            int64_t (*const coords)[3])
+{
+  assert(coords != NULL);
+
+  int const nsides = primitive_get_num_sides(p);
+  if (nsides > MaxExactSides) {
+    return -1;
+  }
+
+  for (int s = 0; s < nsides; ++s) {
+    _Optional Coord (*const c)[3] =
+      vertex_array_get_coords(varray, primitive_get_side(p, s));
+    if (!c) {
+      return -1;
+    }
+    for (size_t dim = 0; dim < ARRAY_SIZE(*c); ++dim) {
+      Coord const value = (*c)[dim];
+      if (!(value >= -MaxExactCoord && value <= MaxExactCoord)) {
+        return -1;
+      }
+      coords[s][dim] = (int64_t)value;
+      if ((Coord)coords[s][dim] != value) {
+        return -1;
+      }
+    }
+  }
+  return nsides;
+}
+
+static int64_t get_exact_cross_2d(int64_t (*const a)[3],
+                                  int64_t (*const b)[3],
+                                  int64_t (*const c)[3],
+                                  int const axis)
+{
+  /* Cross product of (b - a) and (c - a), ignoring one axis */
+  int const u = (axis + 1) % 3, v = (axis + 2) % 3;
+  return (((*b)[u] - (*a)[u]) * ((*c)[v] - (*a)[v])) -
+         (((*b)[v] - (*a)[v]) * ((*c)[u] - (*a)[u]));
+}
+
+static bool in_exact_polygon(ContainerEntry const * const entry,
+                             int64_t (*const coords)[3],
+                             int const nsides,
+                             int64_t (*const point)[3])
+{
+  assert(entry != NULL);
+  assert(entry->exact);
+  assert(coords != NULL);
+  assert(point != NULL);
+
+  int64_t dot = 0;
+  for (int dim = 0; dim < 3; ++dim) {
+    dot += entry->exact_normal[dim] *
+           ((*point)[dim] - entry->exact_origin[dim]);
+  }
+  if (dot != 0) {
+    return false; /* not coplanar */
+  }
+
+  /* The point must be on the inner side of (or on) every edge */
+  for (int s = 0; s < nsides; ++s) {
+    int64_t const cross = get_exact_cross_2d(&coords[s],
+                                             &coords[(s + 1) % nsides],
+                                             point, entry->exact_axis);
+    if ((cross != 0) && ((cross > 0) != (entry->exact_orientation > 0))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void get_exact_geometry(ContainerEntry * const entry,
+                               VertexArray const * const varray,
+                               Primitive const * const p)
+{
+  assert(entry != NULL);
+
+  entry->exact = false;
+
+  int64_t coords[MaxExactSides][3];
+  int const nsides = get_exact_coords(varray, p, coords);
+  if (nsides < 3) {
+    return;
+  }
+
+  /* Find a normal from the first pair of edges that aren't parallel */
+  int64_t *const n = entry->exact_normal;
+  for (int s = 2; s < nsides; ++s) {
+    int64_t a[3], b[3];
+    for (int dim = 0; dim < 3; ++dim) {
+      a[dim] = coords[1][dim] - coords[0][dim];
+      b[dim] = coords[s][dim] - coords[0][dim];
+    }
+    n[0] = (a[1] * b[2]) - (a[2] * b[1]);
+    n[1] = (a[2] * b[0]) - (a[0] * b[2]);
+    n[2] = (a[0] * b[1]) - (a[1] * b[0]);
+    if (n[0] || n[1] || n[2]) {
+      break;
+    }
+  }
+  if (!n[0] && !n[1] && !n[2]) {
+    return; /* all vertices are collinear */
+  }
+
+  int axis = 0;
+  for (int dim = 1; dim < 3; ++dim) {
+    if ((n[dim] < 0 ? -n[dim] : n[dim]) > (n[axis] < 0 ? -n[axis] :
+                                                         n[axis])) {
+      axis = dim;
+    }
+  }
+  entry->exact_axis = axis;
+  entry->exact_orientation = n[axis] > 0 ? 1 : -1;
+  for (int dim = 0; dim < 3; ++dim) {
+    entry->exact_origin[dim] = coords[0][dim];
+  }
+
+  /* Only a convex planar polygon contains every point on the inner side of
+     all of its edges, so other polygons are left to the library. */
+  entry->exact = true;
+  for (int s = 0; (s < nsides) && entry->exact; ++s) {
+    entry->exact = in_exact_polygon(entry, coords, nsides, &coords[s]);
+  }
+}
+
+static bool add_entry(ContainerIndex * const index,
+                      VertexArray const * const varray,
+                      Group const * const groups, int const group,
+                      int const p)
+{
+  assert(index != NULL);
+  assert(groups != NULL);
+
+  _Optional Primitive *const pp = group_get_primitive(groups + group, p);
+  if (!pp) {
+    return false;
+  }
+
+  /* Points and lines can't contain anything */
+  if (primitive_get_num_sides(&*pp) < 3) {
+    return true;
+  }
+
+  ContainerEntry entry = {.group = group, .index = p, .next = -1};
+
+  entry.has_plane = primitive_find_plane(&*pp, varray, &entry.plane);
+  entry.has_normal = primitive_get_normal(&*pp, varray, &entry.normal);
+  if (!get_bounds(varray, &*pp, &entry.min, &entry.max)) {
+    return false;
+  }
+  get_exact_geometry(&entry, varray, &*pp);
+
+  Coord normal[3] = {entry.normal[0], entry.normal[1], entry.normal[2]};
+  Coord distance = 0;
+  bool const any = !entry.has_normal ||
+                   !get_plane(varray, &*pp, &normal, &distance);
+  int const pl = find_plane(index, &normal, distance, any);
+  if (pl < 0) {
+    return false;
+  }
+
+  if (index->nentries == index->entries_size) {
+    int const new_size = index->entries_size ? index->entries_size * 2 :
+                                               InitialIndexSize;
+    _Optional ContainerEntry *const new_entries =
+      realloc(index->entries, sizeof(*new_entries) * (size_t)new_size);
+    if (new_entries == NULL) {
+      return false;
+    }
+    index->entries = new_entries;
+    index->entries_size = new_size;
+  }
+
+  int const e = index->nentries++;
+  index->entries[e] = entry;
+
+  ContainerPlane *const plane = &index->planes[pl];
+  if (plane->last < 0) {
+    plane->first = e;
+  } else {
+    index->entries[plane->last].next = e;
+  }
+  plane->last = e;
+  return true;
+}
+
+static bool update_index(ContainerIndex * const index,
+                         VertexArray const * const varray,
+                         Group const * const groups, int const group)
+{
+  assert(index != NULL);
+  assert(groups != NULL);
+  assert(group >= index->first_group);
+  assert(group < ContainerIndexMaxGroups);
+
+  for (int g = index->first_group; g <= group; ++g) {
+    /* Exclude the most recently-added primitive in the front group
+       because it may still be modified. */
+    int nprimitives = group_get_num_primitives(groups + g);
+    if ((g == group) && (nprimitives > 0)) {
+      --nprimitives;
+    }
+
+    if (index->nindexed[g] > nprimitives) {
+      DEBUGF("Primitives deleted from group %d: rebuilding index\n", g);
+      container_index_clear(index);
+      return update_index(index, varray, groups, group);
+    }
+
+    for (; index->nindexed[g] < nprimitives; ++index->nindexed[g]) {
+      if (!add_entry(index, varray, groups, g, index->nindexed[g])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool in_plane(ContainerPlane const * const plane,
+                     VertexArray const * const varray,
+                     Primitive const * const frontp)
+{
+  assert(plane != NULL);
+
+  if (plane->any) {
+    return true;
+  }
+
+  Coord normal[3] = {plane->normal[0], plane->normal[1], plane->normal[2]};
+  int const nsides = primitive_get_num_sides(frontp);
+  for (int s = 0; s < nsides; ++s) {
+    _Optional Coord (*const coords)[3] =
+      vertex_array_get_coords(varray, primitive_get_side(frontp, s));
+    if (!coords) {
+      return true; /* let the coplanarity test decide */
+    }
+    Coord d = get_distance(&normal, &*coords) - plane->distance;
+    if (d < 0) {
+      d = -d;
+    }
+    if (d > PLANE_TOLERANCE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool in_bounds(ContainerEntry const * const entry,
+                      Coord (*const min)[3], Coord (*const max)[3])
+{
+  assert(entry != NULL);
+
+  for (size_t dim = 0; dim < ARRAY_SIZE(entry->min); ++dim) {
+    if (((*min)[dim] < entry->min[dim] - PLANE_TOLERANCE) ||
+        ((*max)[dim] > entry->max[dim] + PLANE_TOLERANCE)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int compare_candidates(const void *const a, const void *const b)
+{
+  ContainerCandidate const *const ca = a, *const cb = b;
+  if (ca->rank != cb->rank) {
+    return ca->rank < cb->rank ? -1 : 1;
+  }
+  /* Most recent first */
+  if (ca->index != cb->index) {
+    return ca->index > cb->index ? -1 : 1;
+  }
+  return 0;
+}
+
+static bool find_container_indexed(ContainerIndex * const index,
+                                   VertexArray const * const varray,
+                                   Group const * const groups,
+                                   int const group, int *const container)
+{
+  assert(index != NULL);
+  assert(groups != NULL);
+  assert(container != NULL);
+
+  *container = -1;
+
+  Group const * const front_group = groups + group;
+  int const nprimitives = group_get_num_primitives(front_group);
+  if (nprimitives <= 0) {
+    return true;
+  }
+
+  _Optional Primitive *const frontp = group_get_primitive(front_group,
+                                                          nprimitives-1);
+  if (!frontp) {
+    return true;
+  }
+
+  if (!update_index(index, varray, groups, group)) {
+    return false;
+  }
+
+  /* A container's bounding box must enclose that of the front primitive */
+  Coord front_min[3], front_max[3];
+  bool const has_bounds = get_bounds(varray, &*frontp, &front_min,
+                                     &front_max);
+
+  if (index->candidates_size < index->nentries) {
+    _Optional ContainerCandidate *const new_candidates =
+      realloc(index->candidates,
+              sizeof(*new_candidates) * (size_t)index->entries_size);
+    if (new_candidates == NULL) {
+      return false;
+    }
+    index->candidates = new_candidates;
+    index->candidates_size = index->entries_size;
+  }
+
+  /* Gather the polygons in the plane of the front primitive. The same
+     group is searched first, then all previous groups in order. */
+  int ncandidates = 0;
+  for (int pl = 0; pl < index->nplanes; ++pl) {
+    ContainerPlane const *const plane = &index->planes[pl];
+    if (!in_plane(plane, varray, &*frontp)) {
+      continue;
+    }
+    for (int e = plane->first; e >= 0; e = index->entries[e].next) {
+      ContainerEntry const *const entry = &index->entries[e];
+      if (entry->group > group) {
+        continue;
+      }
+      index->candidates[ncandidates++] = (ContainerCandidate){
+        .rank = entry->group == group ? 0 : entry->group + 1,
+        .index = entry->index, .entry = e};
+    }
+  }
+
+  DEBUGF("%d candidate containers in %d planes\n", ncandidates,
+         index->nplanes);
+
+  qsort(&*index->candidates, (size_t)ncandidates,
+        sizeof(index->candidates[0]), compare_candidates);
+
+  int64_t front_coords[MaxExactSides][3];
+  int const nfront = get_exact_coords(varray, &*frontp, front_coords);
+
+  for (int c = 0; c < ncandidates; ++c) {
+    ContainerEntry const *const entry =
+      &index->entries[index->candidates[c].entry];
+
+    /* Points and lines have no plane, so can't contain anything */
+    if (!entry->has_plane && !entry->exact) {
+      continue;
+    }
+
+    if (has_bounds && !in_bounds(entry, &front_min, &front_max)) {
+      DEBUGF("Skipping %d in group %d: out of bounds\n", entry->index,
+             entry->group);
+      continue;
+    }
+
+    _Optional Primitive *const backp =
+      group_get_primitive(groups + entry->group, entry->index);
+    if (!backp) {
+      return true;
+    }
+
+    bool contains;
+    int64_t back_coords[MaxExactSides][3];
+    int nback;
+    if (entry->exact && (nfront >= 0) &&
+        ((nback = get_exact_coords(varray, &*backp, back_coords)) >= 0)) {
+      /* Use integer arithmetic to avoid tolerances */
+      contains = true;
+      for (int s = 0; (s < nfront) && contains; ++s) {
+        contains = in_exact_polygon(entry, back_coords, nback,
+                                    &front_coords[s]);
+      }
+    } else {
+      contains = entry->has_plane &&
+                 primitive_coplanar(&*backp, &*frontp, varray) &&
+                 primitive_contains(&*backp, &*frontp, varray, entry->plane);
+    }
+
+    if (contains) {
+      DEBUGF("Found container %p\n", (void *)backp);
+      *container = index->candidates[c].entry;
+      break;
+    }
+  }
+  return true;
+}
+
+void container_index_init(ContainerIndex * const index)
+{
+  assert(index != NULL);
+
+  *index = (ContainerIndex){.entries = NULL, .planes = NULL,
+                            .candidates = NULL, .first_group = 0};
+  container_index_clear(index);
+}
+
+void container_index_clear(ContainerIndex * const index)
+{
+  assert(index != NULL);
+
+  index->nentries = 0;
+  index->nplanes = 0;
+  for (int g = 0; g < ContainerIndexMaxGroups; ++g) {
+    index->nindexed[g] = 0;
+  }
+}
+
+void container_index_set_first_group(ContainerIndex * const index,
+                                     int const first_group)
+{
+  assert(index != NULL);
+  assert(first_group >= 0);
+  assert(first_group < ContainerIndexMaxGroups);
+
+  container_index_clear(index);
+  index->first_group = first_group;
+}
+
+void container_index_free(ContainerIndex * const index)
+{
+  assert(index != NULL);
+
+  free(index->entries);
+  free(index->planes);
+  free(index->candidates);
+  container_index_init(index);
+}
+
+bool find_container_normal(ContainerIndex * const index,
+                           VertexArray const * const varray,
                            Group const * const groups, int const group,
                            Coord (*const normal)[3])
 {
   bool got_normal = false;
-  _Optional Primitive *const container = find_container(varray, groups, group);
-  if (container != NULL) {
-    got_normal = primitive_get_normal(&*container, varray, normal);
+  int e;
+  if (find_container_indexed(index, varray, groups, group, &e)) {
+    if (e >= 0) {
+      ContainerEntry const *const entry = &index->entries[e];
+      if (entry->has_normal) {
+        for (size_t dim = 0; dim < ARRAY_SIZE(entry->normal); ++dim) {
+          (*normal)[dim] = entry->normal[dim];
+        }
+        got_normal = true;
+      } else if (entry->exact) {
+        /* Polygon too thin for the library to find its normal */
+        for (size_t dim = 0; dim < ARRAY_SIZE(entry->exact_normal); ++dim) {
+          (*normal)[dim] = (Coord)entry->exact_normal[dim];
+        }
+        got_normal = true;
+      }
+    }
+  } else {
+    /* Fall back to searching every primitive */
+    DEBUGF("Failed to index primitives\n");
+    container_index_clear(index);
+    _Optional Primitive *const container =
+      find_container(varray, groups, index->first_group, group);
+    if (container != NULL) {
+      got_normal = primitive_get_normal(&*container, varray, normal);
+    }
   }
   return got_normal;
 }
@@ -23,13 +23,82 @@
 
 /* ISO C library headers */
 #include <stdbool.h>
+#include <stdint.h>
 
 /* 3dObjLib headers */
 #include "Vertex.h"
 #include "Coord.h"
 #include "Group.h"
+#include "Primitive.h"
 
-bool find_container_normal(VertexArray const *varray,
+#if !defined(USE_OPTIONAL) && !defined(_Optional)
+#define _Optional
+#endif
+
+enum {
+  ContainerIndexMaxGroups = 4
+};
+
+/* Geometry of an indexed primitive, computed once when it is indexed */
+typedef struct {
+  int group, index; /* Location of an indexed primitive */
+  int next; /* Next entry in the same plane, or -1 */
+  bool has_plane, has_normal;
+  Plane plane; /* Two-dimensional plane for overlap tests */
+  Coord normal[3]; /* As returned by primitive_get_normal */
+  Coord min[3], max[3]; /* Axis-aligned bounding box */
+  bool exact; /* Convex polygon with small integer coordinates */
+  int exact_axis; /* Axis ignored when projecting into two dimensions */
+  int exact_orientation; /* Winding order (1 or -1) in two dimensions */
+  int64_t exact_normal[3], exact_origin[3];
+} ContainerEntry;
+
+typedef struct {
+  Coord normal[3], distance; /* Normal has a positive major component */
+  bool any; /* Polygon without a normal, so assume any plane */
+  int first, last; /* Entries in the plane, in the order added */
+} ContainerPlane;
+
+typedef struct {
+  int rank, index, entry;
+} ContainerCandidate;
+
+/* Index of the primitives of one object, bucketed by the plane equation of
+   each polygon so that only polygons in the plane of a given primitive need
+   to be tested as potential containers for it. */
+typedef struct {
+  _Optional ContainerEntry *entries;
+  int nentries, entries_size;
+  _Optional ContainerPlane *planes;
+  int nplanes, planes_size;
+  _Optional ContainerCandidate *candidates;
+  int candidates_size;
+  int nindexed[ContainerIndexMaxGroups];
+  int first_group; /* Groups before this one are never searched */
+} ContainerIndex;
+
+void container_index_init(ContainerIndex *index);
+
+/* Must be called whenever primitives are deleted from the groups or the
+   sides of any indexed primitive are changed (for example, by
+   primitive_reverse_sides or primitive_set_normal). The most
+   recently-added primitive in a group is not indexed until another is added
+   after it, so it may be modified freely. */
+void container_index_clear(ContainerIndex *index);
+
+/* Clear the index and exclude groups before 'first_group' from subsequent
+   searches, as if they were empty. This allows primitives decoded in a
+   separate pass into a later group to be treated as a separate model. */
+void container_index_set_first_group(ContainerIndex *index, int first_group);
+
+void container_index_free(ContainerIndex *index);
+
+/* Get the normal of the latest coplanar polygon that fully contains the
+   most recently-added primitive in a group, searching the same group first
+   and then all previous groups (from the first group set for the index
+   onwards). Primitives added since the last call are
+   added to the index. */
+bool find_container_normal(ContainerIndex *index, VertexArray const *varray,
                            Group const *groups, int group,
                            Coord (*normal)[3]);
 
@@ -19,9 +19,19 @@
 #define FLAGS_FALSE_COLOUR       (1u<<9)  /* assign false primitive colours */
 #define FLAGS_DUPLICATE          (1u<<10) /* emit duplicate vertices */
 #define FLAGS_HUMAN_READABLE     (1u<<11) /* use human-readable material names */
+#define FLAGS_LEVELS_OF_DETAIL   (1u<<12) /* emit simplified and complex objects */
 #define FLAGS_SIMPLE             (1u<<13) /* emit simple objects */
 #define FLAGS_EXTRA_MISSIONS     (1u<<14) /* emit extra missions object names */
 #define FLAGS_FLIP_BACKFACING    (1u<<15) /* flip backfacing polygons */
-#define FLAGS_ALL                ((1u<<16)-1)
+#define FLAGS_VERTEX_POOL        (1u<<16) /* share vertices between objects */
+#define FLAGS_SORT_MATERIALS     (1u<<17) /* sort primitives by material */
+#define FLAGS_VERTEX_COLOURS     (1u<<18) /* emit colours with vertices */
+#define FLAGS_ALL                ((1u<<19)-1)
+
+/* Flags which only affect how faces are output, and therefore can differ
+   between output variants */
+#define FLAGS_OUTPUT_STYLE       (FLAGS_NEGATIVE_INDICES | \
+                                  FLAGS_TRIANGLE_FANS | \
+                                  FLAGS_TRIANGLE_STRIPS)
 
 #endif /* FLAGS_H */
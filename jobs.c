@@ -0,0 +1,370 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Pool of worker threads
+ *  Copyright (C) 2018 Christopher Bazley
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public Licence as published by
+ *  the Free Software Foundation; either version 2 of the Licence, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public Licence for more details.
+ *
+ *  You should have received a copy of the GNU General Public Licence
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* ISO library header files */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+/* Local header files */
+#include "jobs.h"
+#include "misc.h"
+
+#ifdef USE_PTHREADS
+typedef struct {
+  pthread_mutex_t lock;
+  int next_job, njobs;
+  _Optional int const *order;
+  JobsFn *fn;
+  void *arg;
+} JobsQueue;
+
+static void run_queue(JobsQueue *const queue)
+{
+  assert(queue != NULL);
+
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    int const job = (queue->next_job < queue->njobs) ? queue->next_job++ : -1;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (job < 0) {
+      break;
+    }
+    queue->fn(queue->arg, queue->order != NULL ? queue->order[job] : job);
+  }
+}
+
+static void *worker(void *const arg)
+{
+  run_queue(arg);
+  return NULL;
+}
+#endif /* USE_PTHREADS */
+
+struct JobsPipeline {
+  JobsFn *fn;
+  JobsWriteFn *write_fn;
+  void *arg;
+  int nslots;
+  bool failed;
+#ifdef USE_PTHREADS
+  bool threaded, finishing;
+  pthread_mutex_t lock;
+  pthread_cond_t changed; /* Signalled whenever any of the following change */
+  int nfilled, nwritten, nfree, nready, nworkers;
+  int *free_slots; /* Stack of slots that can be filled */
+  int *order; /* Ring buffer of slots in the order they were filled */
+  int *ready; /* Slots that are filled but not yet being processed */
+  int *done; /* Flags for slots that are ready to be written */
+  pthread_t writer, workers[JobsMaxThreads];
+  long int costs[]; /* Estimated cost of processing each slot, followed
+                       by storage for the above arrays */
+#endif
+};
+
+#ifdef USE_PTHREADS
+static void *pipeline_worker(void *const arg)
+{
+  JobsPipeline *const pipeline = arg;
+  assert(pipeline != NULL);
+
+  pthread_mutex_lock(&pipeline->lock);
+  for (;;) {
+    while (!pipeline->failed && !pipeline->finishing &&
+           (pipeline->nready == 0)) {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+
+    if (pipeline->failed || (pipeline->nready == 0)) {
+      break;
+    }
+
+    /* Start the most expensive slot first so that a long-running job
+       doesn't hold up the end of the pipeline whilst other threads wait
+       for the writer to free up a slot. */
+    int best = 0;
+    for (int r = 1; r < pipeline->nready; ++r) {
+      if (pipeline->costs[pipeline->ready[r]] >
+          pipeline->costs[pipeline->ready[best]]) {
+        best = r;
+      }
+    }
+    int const slot = pipeline->ready[best];
+    pipeline->ready[best] = pipeline->ready[--pipeline->nready];
+    pthread_mutex_unlock(&pipeline->lock);
+
+    pipeline->fn(pipeline->arg, slot);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->done[slot] = 1;
+    pthread_cond_broadcast(&pipeline->changed);
+  }
+  pthread_mutex_unlock(&pipeline->lock);
+  return NULL;
+}
+
+static void *pipeline_writer(void *const arg)
+{
+  JobsPipeline *const pipeline = arg;
+  assert(pipeline != NULL);
+
+  pthread_mutex_lock(&pipeline->lock);
+  for (;;) {
+    /* Slots are written in the order they were filled, regardless of
+       the order in which their processing finishes. */
+    while (!pipeline->failed &&
+           ((pipeline->nwritten < pipeline->nfilled) ?
+            !pipeline->done[pipeline->order[pipeline->nwritten %
+                                            pipeline->nslots]] :
+            !pipeline->finishing)) {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+
+    if (pipeline->failed || (pipeline->nwritten == pipeline->nfilled)) {
+      break;
+    }
+
+    int const slot = pipeline->order[pipeline->nwritten % pipeline->nslots];
+    pthread_mutex_unlock(&pipeline->lock);
+
+    bool const success = pipeline->write_fn(pipeline->arg, slot);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->done[slot] = 0;
+    if (success) {
+      ++pipeline->nwritten;
+      pipeline->free_slots[pipeline->nfree++] = slot;
+    } else {
+      pipeline->failed = true;
+    }
+    pthread_cond_broadcast(&pipeline->changed);
+  }
+  pthread_mutex_unlock(&pipeline->lock);
+  return NULL;
+}
+
+static bool pipeline_threads_start(JobsPipeline *const pipeline,
+                                   int const nthreads)
+{
+  assert(pipeline != NULL);
+  assert(nthreads >= 1);
+
+  if (pthread_mutex_init(&pipeline->lock, NULL)) {
+    return false;
+  }
+
+  if (!pthread_cond_init(&pipeline->changed, NULL)) {
+    if (!pthread_create(&pipeline->writer, NULL, pipeline_writer,
+                        pipeline)) {
+      while ((pipeline->nworkers < nthreads) &&
+             !pthread_create(pipeline->workers + pipeline->nworkers, NULL,
+                             pipeline_worker, pipeline)) {
+        ++pipeline->nworkers;
+      }
+      DEBUGF("Started %d of %d pipeline worker threads\n",
+             pipeline->nworkers, nthreads);
+
+      if (pipeline->nworkers > 0) {
+        return true;
+      }
+
+      pthread_mutex_lock(&pipeline->lock);
+      pipeline->finishing = true;
+      pthread_cond_broadcast(&pipeline->changed);
+      pthread_mutex_unlock(&pipeline->lock);
+      pthread_join(pipeline->writer, NULL);
+    }
+    pthread_cond_destroy(&pipeline->changed);
+  }
+  pthread_mutex_destroy(&pipeline->lock);
+  return false;
+}
+#endif /* USE_PTHREADS */
+
+void jobs_run(int const nthreads, int const njobs, JobsFn *const fn,
+              void *const arg)
+{
+  jobs_run_ordered(nthreads, njobs, NULL, fn, arg);
+}
+
+void jobs_run_ordered(int const nthreads, int const njobs,
+                      _Optional int const * const order, JobsFn *const fn,
+                      void *const arg)
+{
+  assert(nthreads >= 1);
+  assert(nthreads <= JobsMaxThreads);
+  assert(njobs >= 0);
+  assert(fn != NULL);
+
+#ifdef USE_PTHREADS
+  int const nworkers = (nthreads < njobs ? nthreads : njobs) - 1;
+  if (nworkers > 0) {
+    JobsQueue queue = {.next_job = 0, .njobs = njobs, .order = order,
+                       .fn = fn, .arg = arg};
+    if (!pthread_mutex_init(&queue.lock, NULL)) {
+      /* If a thread can't be created then the remaining threads (including
+         the caller) simply take on more of the jobs. */
+      pthread_t threads[JobsMaxThreads];
+      int nstarted = 0;
+      while ((nstarted < nworkers) &&
+             !pthread_create(threads + nstarted, NULL, worker, &queue)) {
+        ++nstarted;
+      }
+      DEBUGF("Started %d of %d worker threads\n", nstarted, nworkers);
+
+      run_queue(&queue);
+
+      for (int t = 0; t < nstarted; ++t) {
+        pthread_join(threads[t], NULL);
+      }
+      pthread_mutex_destroy(&queue.lock);
+      return;
+    }
+  }
+#endif /* USE_PTHREADS */
+
+  for (int job = 0; job < njobs; ++job) {
+    fn(arg, order != NULL ? order[job] : job);
+  }
+}
+
+_Optional JobsPipeline *jobs_pipeline_start(int const nthreads,
+                                            int const nslots,
+                                            JobsFn *const fn,
+                                            JobsWriteFn *const write_fn,
+                                            void *const arg)
+{
+  assert(nthreads >= 1);
+  assert(nthreads <= JobsMaxThreads);
+  assert(nslots >= 1);
+  assert(fn != NULL);
+  assert(write_fn != NULL);
+
+  size_t size = sizeof(JobsPipeline);
+#ifdef USE_PTHREADS
+  size += (sizeof(long int) + (sizeof(int) * 4)) * (size_t)nslots;
+#endif
+
+  _Optional JobsPipeline *const pipeline = malloc(size);
+  if (pipeline == NULL) {
+    return NULL;
+  }
+
+  *pipeline = (JobsPipeline){.fn = fn, .write_fn = write_fn, .arg = arg,
+                             .nslots = nslots, .failed = false};
+
+#ifdef USE_PTHREADS
+  pipeline->free_slots = (int *)(pipeline->costs + nslots);
+  pipeline->order = pipeline->free_slots + nslots;
+  pipeline->ready = pipeline->order + nslots;
+  pipeline->done = pipeline->ready + nslots;
+
+  /* Slots are handed out in ascending order to begin with */
+  for (int s = 0; s < nslots; ++s) {
+    pipeline->free_slots[s] = nslots - 1 - s;
+    pipeline->done[s] = 0;
+  }
+  pipeline->nfree = nslots;
+
+  /* If no threads can be created then each slot is processed and
+     written as soon as it has been filled. */
+  pipeline->threaded = pipeline_threads_start(&*pipeline, nthreads);
+#endif /* USE_PTHREADS */
+
+  return pipeline;
+}
+
+int jobs_pipeline_get_slot(JobsPipeline *const pipeline)
+{
+  assert(pipeline != NULL);
+
+#ifdef USE_PTHREADS
+  if (pipeline->threaded) {
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->failed && (pipeline->nfree == 0)) {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+    int const slot = pipeline->failed ? -1 :
+                     pipeline->free_slots[--pipeline->nfree];
+    pthread_mutex_unlock(&pipeline->lock);
+    return slot;
+  }
+#endif /* USE_PTHREADS */
+
+  return pipeline->failed ? -1 : 0;
+}
+
+void jobs_pipeline_put_slot(JobsPipeline *const pipeline, int const slot,
+                            long int const cost)
+{
+  assert(pipeline != NULL);
+  assert(slot >= 0);
+  assert(slot < pipeline->nslots);
+
+#ifdef USE_PTHREADS
+  if (pipeline->threaded) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->order[pipeline->nfilled++ % pipeline->nslots] = slot;
+    pipeline->costs[slot] = cost;
+    pipeline->ready[pipeline->nready++] = slot;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+    return;
+  }
+#else
+  NOT_USED(cost);
+#endif /* USE_PTHREADS */
+
+  pipeline->fn(pipeline->arg, slot);
+  if (!pipeline->write_fn(pipeline->arg, slot)) {
+    pipeline->failed = true;
+  }
+}
+
+bool jobs_pipeline_finish(JobsPipeline *const pipeline)
+{
+  assert(pipeline != NULL);
+
+#ifdef USE_PTHREADS
+  if (pipeline->threaded) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->finishing = true;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    for (int t = 0; t < pipeline->nworkers; ++t) {
+      pthread_join(pipeline->workers[t], NULL);
+    }
+    pthread_join(pipeline->writer, NULL);
+
+    pthread_cond_destroy(&pipeline->changed);
+    pthread_mutex_destroy(&pipeline->lock);
+  }
+#endif /* USE_PTHREADS */
+
+  bool const success = !pipeline->failed;
+  free(pipeline);
+  return success;
+}
@@ -0,0 +1,60 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Pool of worker threads
+ *  Copyright (C) 2018 Christopher Bazley
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+/* ISO C library headers */
+#include <stdbool.h>
+
+#if !defined(USE_OPTIONAL) && !defined(_Optional)
+#define _Optional
+#endif
+
+enum {
+  JobsMaxThreads = 64
+};
+
+typedef void JobsFn(void *arg, int job);
+
+/* Call fn once for each job number in the range 0..njobs-1, using up to
+   nthreads threads (including the caller). Jobs are run in ascending order
+   if only one thread is used or if threads are not supported. */
+void jobs_run(int nthreads, int njobs, JobsFn *fn, void *arg);
+
+/* As jobs_run, except that jobs are started in the order given by an
+   array of job numbers instead of ascending order. */
+void jobs_run_ordered(int nthreads, int njobs, _Optional int const *order,
+                      JobsFn *fn, void *arg);
+
+/* A pipeline in which the caller fills slots, worker threads process them
+   and another thread writes them out in the order that they were filled.
+   No more than nslots slots are ever in use, so memory usage is bounded. */
+typedef struct JobsPipeline JobsPipeline;
+
+typedef bool JobsWriteFn(void *arg, int slot);
+
+/* Start a pipeline which calls fn for each filled slot using up to
+   nthreads threads and then write_fn for each processed slot. If threads
+   are not supported then everything is done on the caller's thread. */
+_Optional JobsPipeline *jobs_pipeline_start(int nthreads, int nslots,
+                                            JobsFn *fn, JobsWriteFn *write_fn,
+                                            void *arg);
+
+/* Get a slot to fill, waiting until one is free. Returns -1 if a call to
+   write_fn has failed, after which no more slots should be filled. */
+int jobs_pipeline_get_slot(JobsPipeline *pipeline);
+
+/* Pass a filled slot to the next stage of a pipeline. Of the slots
+   waiting to be processed, the one with the highest estimated cost is
+   processed first. */
+void jobs_pipeline_put_slot(JobsPipeline *pipeline, int slot, long int cost);
+
+/* Wait for all filled slots to be written, then destroy a pipeline.
+   Returns false if any call to write_fn failed. */
+bool jobs_pipeline_finish(JobsPipeline *pipeline);
+
+#endif /* JOBS_H */
@@ -20,6 +20,15 @@
 #endif
 #endif
 
+/* Separator between a file name and its extension */
+#ifndef EXTENSION_SEPARATOR
+#ifdef ACORN_C
+#define EXTENSION_SEPARATOR '/'
+#else
+#define EXTENSION_SEPARATOR '.'
+#endif
+#endif
+
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
 
 /* Suppress compiler warnings about an unused function argument. */
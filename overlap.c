@@ -0,0 +1,203 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Find primitives that might overlap
+ *  Copyright (C) 2018 Christopher Bazley
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public Licence as published by
+ *  the Free Software Foundation; either version 2 of the Licence, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public Licence for more details.
+ *
+ *  You should have received a copy of the GNU General Public Licence
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* ISO library header files */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* 3dObjLib headers */
+#include "Vertex.h"
+#include "Primitive.h"
+#include "Vector.h"
+#include "Coord.h"
+#include "Group.h"
+
+/* Local header files */
+#include "overlap.h"
+#include "arena.h"
+#include "misc.h"
+
+/* Primitives further apart than this are assumed not to overlap. This is
+   much looser than the tolerance of the exact tests used for clipping. */
+#define TOLERANCE (1.0)
+
+typedef struct {
+  Primitive *p;
+  bool has_normal; /* false for points, lines and degenerate polygons */
+  Coord normal[3], distance;
+  Coord min[3], max[3];
+} PrimitiveBounds;
+
+static Coord dot_product(Coord (*const a)[3], Coord (*const b)[3])
+{
+  return ((*a)[0] * (*b)[0]) + ((*a)[1] * (*b)[1]) + ((*a)[2] * (*b)[2]);
+}
+
+static bool get_bounds(VertexArray const * const varray,
+                       PrimitiveBounds * const b)
+{
+  assert(b != NULL);
+
+  int const nsides = primitive_get_num_sides(b->p);
+  for (int s = 0; s < nsides; ++s) {
+    _Optional Coord (*const coords)[3] =
+      vertex_array_get_coords(varray, primitive_get_side(b->p, s));
+    if (!coords) {
+      return false;
+    }
+    for (size_t dim = 0; dim < ARRAY_SIZE(*coords); ++dim) {
+      if ((s == 0) || ((*coords)[dim] < b->min[dim])) {
+        b->min[dim] = (*coords)[dim];
+      }
+      if ((s == 0) || ((*coords)[dim] > b->max[dim])) {
+        b->max[dim] = (*coords)[dim];
+      }
+    }
+    if (s == 0) {
+      b->distance = dot_product(&b->normal, &*coords);
+    }
+  }
+  return nsides > 0;
+}
+
+/* Are all vertices of a primitive near the plane of another? */
+static bool in_plane(VertexArray const * const varray,
+                     PrimitiveBounds const * const plane,
+                     PrimitiveBounds const * const b)
+{
+  assert(plane != NULL);
+  assert(plane->has_normal);
+  assert(b != NULL);
+
+  Coord normal[3] = {plane->normal[0], plane->normal[1], plane->normal[2]};
+  int const nsides = primitive_get_num_sides(b->p);
+  for (int s = 0; s < nsides; ++s) {
+    _Optional Coord (*const coords)[3] =
+      vertex_array_get_coords(varray, primitive_get_side(b->p, s));
+    if (!coords) {
+      return true;
+    }
+    Coord d = dot_product(&normal, &*coords) - plane->distance;
+    if (d < 0) {
+      d = -d;
+    }
+    if (d > TOLERANCE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int compare_min_x(const void *const a, const void *const b)
+{
+  PrimitiveBounds const *const ba = a, *const bb = b;
+  if (ba->min[0] != bb->min[0]) {
+    return ba->min[0] < bb->min[0] ? -1 : 1;
+  }
+  return 0;
+}
+
+static bool pair_may_overlap(VertexArray const * const varray,
+                             PrimitiveBounds const * const a,
+                             PrimitiveBounds const * const b)
+{
+  assert(a != NULL);
+  assert(b != NULL);
+
+  /* Reject pairs with disjoint bounding boxes */
+  for (size_t dim = 1; dim < ARRAY_SIZE(a->min); ++dim) {
+    if ((a->min[dim] > b->max[dim] + TOLERANCE) ||
+        (b->min[dim] > a->max[dim] + TOLERANCE)) {
+      return false;
+    }
+  }
+
+  /* Points and lines lie in more than one plane */
+  if (!a->has_normal || !b->has_normal) {
+    return true;
+  }
+
+  return in_plane(varray, a, b);
+}
+
+bool may_overlap(VertexArray const * const varray,
+                 Group const * const groups, int const ngroups,
+                 Arena * const arena)
+{
+  assert(groups != NULL);
+  assert(ngroups >= 0);
+  assert(arena != NULL);
+
+  int nprimitives = 0;
+  for (int g = 0; g < ngroups; ++g) {
+    nprimitives += group_get_num_primitives(groups + g);
+  }
+  if (nprimitives < 2) {
+    return false;
+  }
+
+  _Optional PrimitiveBounds *const bounds =
+    arena_alloc(arena, sizeof(*bounds) * (size_t)nprimitives);
+  if (bounds == NULL) {
+    return true;
+  }
+
+  bool overlap = false;
+  int n = 0;
+  for (int g = 0; (g < ngroups) && !overlap; ++g) {
+    int const count = group_get_num_primitives(groups + g);
+    for (int p = 0; (p < count) && !overlap; ++p) {
+      _Optional Primitive *const pp = group_get_primitive(groups + g, p);
+      if (!pp) {
+        overlap = true;
+        break;
+      }
+
+      PrimitiveBounds *const b = &bounds[n++];
+      *b = (PrimitiveBounds){.p = &*pp};
+      Coord normal[3];
+      b->has_normal = (primitive_get_num_sides(&*pp) >= 3) &&
+                      primitive_get_normal(&*pp, varray, &normal) &&
+                      vector_norm(&normal, &b->normal);
+      if (!get_bounds(varray, b)) {
+        overlap = true;
+      }
+    }
+  }
+
+  if (!overlap) {
+    /* Sweep along the x axis, only comparing primitives whose extents on
+       that axis overlap. */
+    qsort(&*bounds, (size_t)n, sizeof(bounds[0]), compare_min_x);
+
+    for (int i = 0; (i < n) && !overlap; ++i) {
+      for (int j = i + 1; (j < n) && !overlap; ++j) {
+        if (bounds[j].min[0] > bounds[i].max[0] + TOLERANCE) {
+          break;
+        }
+        overlap = pair_may_overlap(varray, &bounds[i], &bounds[j]);
+      }
+    }
+  }
+
+  DEBUGF("%d primitives %s overlap\n", n, overlap ? "may" : "don't");
+  return overlap;
+}
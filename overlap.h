@@ -0,0 +1,27 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Find primitives that might overlap
+ *  Copyright (C) 2018 Christopher Bazley
+ */
+
+#ifndef OVERLAP_H
+#define OVERLAP_H
+
+/* ISO C library headers */
+#include <stdbool.h>
+
+/* 3dObjLib headers */
+#include "Vertex.h"
+#include "Group.h"
+
+/* Local headers */
+#include "arena.h"
+
+/* Find whether any two primitives in the given groups might overlap in the
+   same plane, in which case clip_polygons has work to do. Working storage
+   is allocated from the given arena. Returns true if unsure (e.g. if memory
+   could not be allocated). */
+bool may_overlap(VertexArray const *varray, Group const *groups,
+                 int ngroups, Arena *arena);
+
+#endif /* OVERLAP_H */
@@ -30,6 +30,7 @@
 
 /* StreamLib headers */
 #include "Reader.h"
+#include "ReaderMem.h"
 
 /* 3dObjLib headers */
 #include "Vector.h"
@@ -47,6 +48,11 @@
 #include "names.h"
 #include "findnorm.h"
 #include "colours.h"
+#include "jobs.h"
+#include "duplicates.h"
+#include "overlap.h"
+#include "arena.h"
+#include "vpool.h"
 #include "misc.h"
 
 /* Unless we do something about, all of the objects appear reflected in the
@@ -70,6 +76,7 @@ enum {
   DarkGreyColour = 3,
   NColours = 256,
   NTints = 1 << 2,
+  VertexLineSize = 256,
 };
 
 /* Special numbers for the third vertex */
@@ -100,11 +107,163 @@ enum {
 enum {
   Group_Simple,
   Group_Complex,
+  Group_Simplified, /* Simplified model in level-of-detail mode */
   Group_Count
 };
 
+enum {
+  BytesPerHeader = 32,
+  MaxBytesPerObject = BytesPerHeader + (BytesPerVertex * MaxNumVertices) +
+                      (BytesPerPrimitive * MaxNumPrimitives),
+  MaxObjectNameLen = 64,
+  MaxMaterialNameLen = 32,
+  SlotsPerThread = 4, /* Objects in the pipeline per conversion thread */
+  MaxNamesPerSlot = 8 /* Names under which one converted object is output */
+};
+
+typedef struct {
+  int32_t simple_dist;
+  int32_t nprimitives;
+  int32_t nvertices;
+  int32_t nsprimitives;
+  int32_t nsvertices;
+  int32_t clip_dist;
+  int32_t primitive_style;
+} ObjectHeader;
+
+/* The most recently converted object, which can be output again under
+   the name of any other object with the same model data address. */
+typedef struct {
+  bool valid;
+  int32_t address;
+  int object_count;
+  ObjectHeader hdr;
+  int vobject;
+} ConvertedObject;
+
+typedef struct PooledOutput PooledOutput;
+
+/* Temporary file reused for every object written by one thread in vertex
+   colour mode. It is only created when first needed. */
+typedef struct {
+  _Optional FILE *f;
+} ScratchFile;
+
+/* Destination of converted objects: either one file for all of them, in
+   which case vertex numbers continue from one object to the next, or
+   one file per object in a directory. Objects may be written to several
+   variants of the single file, which differ only in how faces are
+   output. */
+typedef struct {
+  int nout;
+  OutputVariant const *out;
+  _Optional const char *out_dir;
+  const char *mtl_file;
+  int vtotal; /* Number of vertices written to each variant */
+  _Optional PooledOutput *pool; /* Vertices shared between objects */
+  ScratchFile scratch; /* Used by the thread that writes objects in order */
+} ObjectOutput;
+
+/* Copy of the latest object to be output, whose primitives refer to
+   vertices in a pool shared by all objects in the output file instead of
+   the object's own vertices */
+struct PooledOutput {
+  VertexPool vertices;
+  int nvertices; /* Number of vertices in the pool already written */
+  Group groups[Group_Count];
+};
+
+/* Copy of an object in which each vertex is used with only one colour, so
+   that colours can be output as part of the vertices instead of as
+   materials */
+typedef struct {
+  VertexPool positions; /* Distinct coordinates of the original vertices */
+  VertexArray varray; /* Vertices of the copy, marked as used */
+  Group groups[Group_Count];
+  _Optional int *colours; /* Colour of each vertex of the copy */
+  _Optional int *first; /* First vertex of the copy at each position */
+  _Optional int *next; /* Next vertex of the copy at the same position */
+} ColouredObject;
+
+/* State for one object being converted in parallel with others */
+typedef struct ObjectSlot ObjectSlot;
+struct ObjectSlot {
+  int object_count;
+  int32_t address; /* Offset from the lowest address for shared objects */
+  _Optional ObjectSlot *source; /* Shared object with the same model data */
+  int nnames; /* Number of objects with the same address */
+  int object_counts[MaxNamesPerSlot];
+  char object_names[MaxNamesPerSlot][MaxObjectNameLen];
+  unsigned char data[MaxBytesPerObject];
+  size_t size;
+  long int cost; /* Estimated relative cost of conversion */
+  ObjectHeader hdr;
+  VertexArray varray;
+  Group groups[Group_Count];
+  ContainerIndex containers;
+  Arena arena;
+  ScratchFile scratch; /* Used if objects are written concurrently */
+  int vobject;
+  bool success, written;
+};
+
+/* Objects are read by the thread that reads the index, converted by a
+   pool of worker threads, then written by another thread in the order
+   that they were read. */
+typedef struct {
+  ObjectSlot *slots;
+  int nslots, count, nthreads;
+  Coord thick;
+  unsigned int flags;
+  _Optional JobsPipeline *pipeline;
+  int pending; /* Slot not yet passed to the pipeline, or -1 */
+  _Optional ObjectOutput *output;
+} ObjectBatch;
+
+struct SharedObjects {
+  ObjectBatch *batch; /* Slots in ascending order of offset */
+  long int size;
+};
+
+/* Material names are formatted in advance because output_primitives asks
+   for the name of every primitive's material. */
+typedef struct {
+  char name[MaxMaterialNameLen];
+  int len;
+} MaterialName;
+
+static MaterialName material_names[NColours], human_material_names[NColours];
+
+static int32_t get_int32(unsigned char const *const bytes)
+{
+  assert(bytes != NULL);
+
+  uint32_t const u = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+                     ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+
+  return u <= INT32_MAX ? (int32_t)u : -(int32_t)(UINT32_MAX - u) - 1;
+}
+
+static void decode_vertices(int32_t (* const coords)[3],
+                            unsigned char (* const block)[BytesPerVertex],
+                            const int n)
+{
+  assert(coords != NULL);
+  assert(block != NULL);
+  assert(n >= 0);
+
+  /* Keep this loop free of calls and branches (other than get_int32, which
+     should be inlined) so that the compiler can vectorize it. */
+  for (int v = 0; v < n; ++v) {
+    for (size_t dim = 0; dim < ARRAY_SIZE(coords[v]); ++dim) {
+      coords[v][dim] = get_int32(block[v] + (dim * 4));
+    }
+  }
+}
+
 static bool parse_vertices(Reader * const r, const int object_count,
                           VertexArray * const varray,
+                          int32_t (* const file_coords)[3],
                           const int nvertices, const int nsvertices,
                           const unsigned int flags)
 {
@@ -112,6 +271,7 @@ static bool parse_vertices(Reader * const r, const int object_count,
   assert(!reader_ferror(r));
   assert(object_count >= 0);
   assert(varray != NULL);
+  assert(file_coords != NULL);
   assert(nvertices > 0);
   assert(nvertices <= MaxNumVertices);
   assert(nsvertices > 0);
@@ -136,17 +296,21 @@ static bool parse_vertices(Reader * const r, const int object_count,
     }
   }
 
-  for (int v = 0; v < n; ++v) {
-    Coord pos[3] = {0.0, 0.0, 0.0};
-    for (size_t dim = 0; dim < ARRAY_SIZE(pos); ++dim) {
-      int32_t coord;
-      if (!reader_fread_int32(&coord, r)) {
-        fprintf(stderr, "Failed to read vertex %d\n", v);
-        return false;
-      }
-      pos[dim] = coord;
-    } /* next dimension */
+  /* Read all of the vertex coordinates at once and decode them from
+     memory instead of reading each coordinate separately. */
+  unsigned char block[MaxNumVertices][BytesPerVertex];
+  assert((size_t)n <= ARRAY_SIZE(block));
+
+  size_t const nread = reader_fread(block, BytesPerVertex, (size_t)n, r);
+  if (nread < (size_t)n) {
+    fprintf(stderr, "Failed to read vertex %d\n", (int)nread);
+    return false;
+  }
 
+  decode_vertices(file_coords, block, n);
+
+  for (int v = 0; v < n; ++v) {
+    Coord pos[3] = {file_coords[v][0], file_coords[v][1], file_coords[v][2]};
 #if FLIP_Z
     pos[2] = -pos[2]; /* flip z axis */
 #endif
@@ -313,6 +477,7 @@ static bool get_thick_vec(Coord (*const normal)[3],
 
 static bool make_special_hatch(VertexArray * const varray,
                                Group (* const groups)[Group_Count],
+                               ContainerIndex * const containers,
                                int const group, int const n,
                                int const colour, Coord const thick,
                                unsigned int const flags)
@@ -353,7 +518,7 @@ static bool make_special_hatch(VertexArray * const varray,
   bool thicken = false, reverse = false;
   if (thick == 0) {
     DEBUGF("Thickening disabled\n");
-  } else if (find_container_normal(varray, *groups, group, &norm)) {
+  } else if (find_container_normal(containers, varray, *groups, group, &norm)) {
     thicken = get_thick_vec(&norm, &vecw, thick/2, &thickvec);
     if (thicken) {
       if (flags & FLAGS_VERBOSE) {
@@ -458,6 +623,7 @@ static bool make_special_hatch(VertexArray * const varray,
 
 static bool make_special_quads(VertexArray * const varray,
                                Group (* const groups)[Group_Count],
+                               ContainerIndex * const containers,
                                int const group, int const n,
                                int const colour, unsigned int const flags)
 {
@@ -495,11 +661,13 @@ static bool make_special_quads(VertexArray * const varray,
 
   Coord norm[3];
   bool reverse = false;
-  bool got_normal = find_container_normal(varray, *groups, group, &norm);
+  bool got_normal = find_container_normal(containers, varray, *groups, group,
+                                          &norm);
   if (!got_normal) {
     /* Try to find a container facing the opposite direction */
     primitive_reverse_sides(&*pp);
-    got_normal = find_container_normal(varray, *groups, group, &norm);
+    got_normal = find_container_normal(containers, varray, *groups, group,
+                                       &norm);
     primitive_reverse_sides(&*pp);
   }
 
@@ -690,6 +858,7 @@ static bool make_special_points(VertexArray * const varray,
 
 static bool make_special_dashed(VertexArray * const varray,
                                 Group (* const groups)[Group_Count],
+                                ContainerIndex * const containers,
                                 int const group, int const n,
                                 int const colour, Coord const thick,
                                 unsigned int const flags)
@@ -730,7 +899,7 @@ static bool make_special_dashed(VertexArray * const varray,
   bool thicken = false, reverse = false;
   if (thick == 0) {
     DEBUGF("Thickening disabled\n");
-  } else if (find_container_normal(varray, *groups, group, &norm)) {
+  } else if (find_container_normal(containers, varray, *groups, group, &norm)) {
     thicken = get_thick_vec(&norm, &vec, thick/2, &thickvec);
     if (thicken) {
       if (flags & FLAGS_VERBOSE) {
@@ -831,6 +1000,7 @@ static bool make_special_dashed(VertexArray * const varray,
 
 static bool thicken_line(VertexArray * const varray,
                          Group (* const groups)[Group_Count],
+                         ContainerIndex * const containers,
                          int const group, Coord const thick,
                          unsigned int const flags)
 {
@@ -862,7 +1032,7 @@ static bool thicken_line(VertexArray * const varray,
   Coord thickvec[3], norm[3];
   bool thicken = false;
 
-  if (find_container_normal(varray, *groups, group, &norm)) {
+  if (find_container_normal(containers, varray, *groups, group, &norm)) {
     thicken = get_thick_vec(&norm, &vec, thick/2, &thickvec);
   }
 
@@ -920,15 +1090,19 @@ static bool thicken_line(VertexArray * const varray,
 
 static void flip_backfacing(VertexArray * const varray,
                             Group (* const groups)[Group_Count],
+                            const int first_group, const int last_group,
                             const unsigned int flags)
 {
   assert(varray != NULL);
   assert(groups != NULL);
+  assert(first_group >= 0);
+  assert(first_group <= last_group);
+  assert(last_group < Group_Count);
   assert(flags & FLAGS_FLIP_BACKFACING);
   assert(!(flags & ~FLAGS_ALL));
 
   Coord norm[3] = {0,0,1};
-  for (int g = 0; g < Group_Count; ++g) {
+  for (int g = first_group; g <= last_group; ++g) {
     int const n = group_get_num_primitives((*groups) + g);
     for (int p = 0; p < n; ++p) {
       _Optional Primitive *const pp = group_get_primitive((*groups) + g, p);
@@ -944,21 +1118,115 @@ static void flip_backfacing(VertexArray * const varray,
   }
 }
 
+static int count_dashes(int const n, Coord const thick)
+{
+  /* Thickened dashes are quads; otherwise all but the first dash of a
+     line need two new vertices. */
+  return thick > 0 ? n * 4 : (n * 2) - 1;
+}
+
+/* Count the vertices to be generated for special primitives and thick
+   lines so that space for them can be allocated at once. Whether lines
+   are thickened depends on finding a container, so the count assumes
+   that they are. */
+static int count_special_vertices(
+                    unsigned char (* const block)[BytesPerPrimitive],
+                    int const n, int32_t const simple_dist,
+                    Coord const thick, unsigned int const flags)
+{
+  assert(block != NULL);
+  assert(n >= 0);
+  assert(thick >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  int count = 0;
+  for (int p = 0; p < n; ++p) {
+    unsigned char const *const primitive = block[p];
+    int nsides;
+    for (nsides = 0; nsides < MaxNumSides; ++nsides) {
+      if (primitive[nsides] == 0) {
+        break;
+      }
+    }
+
+    /* Same inference as parse_primitives */
+    const int32_t prim_simple_dist =
+      get_int32(primitive + MaxNumSides + 1 + PaddingBeforePrimSimpDist);
+
+    if ((flags & FLAGS_SIMPLE) && (prim_simple_dist <= simple_dist) &&
+        (nsides > 2)) {
+      nsides = 2;
+    }
+
+    if (nsides > 2) {
+      switch (primitive[2]) {
+      case Special8DashThinWhiteLine:
+        count += count_dashes(8, thick);
+        continue;
+      case Special16DashThinWhiteLine:
+        count += count_dashes(16, thick);
+        continue;
+      case Special32DashThickWhiteLine:
+        count += count_dashes(32, thick);
+        continue;
+      default:
+        break;
+      }
+    }
+
+    if (nsides > 3) {
+      switch (primitive[3]) {
+      case Special32OrangePoints:
+        count += 32;
+        break;
+      case Special16DarkGreyQuads:
+      case Special16WhiteQuadsCheckZ:
+      case Special16WhiteQuads:
+        /* The first quad reuses two vertices of the original triangle */
+        count += (16 * 4) - 2;
+        break;
+      case Special64ThickPeruLines:
+        count += count_dashes(64, thick);
+        break;
+      case Special16ThinBlackZigZags:
+        count += 16;
+        break;
+      case Special8PeridotQuadsCheckZ:
+      case Special8PeridotQuads:
+        count += (8 * 4) - 2;
+        break;
+      default:
+        break;
+      }
+    } else if ((nsides == 2) && (thick > 0)) {
+      count += 4;
+    }
+  }
+  return count;
+}
+
 static bool parse_primitives(Reader * const r, const int object_count,
                              VertexArray * const varray,
+                             int32_t (* const file_coords)[3],
+                             const int nfile,
                              Group (* const groups)[Group_Count],
+                             ContainerIndex * const containers,
                              const int32_t simple_dist,
                              const int nprimitives, const int nsprimitives,
+                             const int nsvertices,
                              Coord const thick, const unsigned int flags)
 {
   assert(r != NULL);
   assert(object_count >= 0);
   assert(!reader_ferror(r));
+  assert(file_coords != NULL);
+  assert(nfile >= 0);
   assert(groups != NULL);
   assert(simple_dist >= 0);
   assert(nprimitives > 0);
   assert(nsprimitives > 0);
   assert(nsprimitives <= nprimitives);
+  assert(nsvertices > 0);
   assert(thick >= 0);
   assert(!(flags & ~FLAGS_ALL));
 
@@ -968,19 +1236,67 @@ static bool parse_primitives(Reader * const r, const int object_count,
            nprimitives, nsprimitives, pos, pos);
   }
 
-  int n;
+  int n, nsimplified = 0;
   if (flags & FLAGS_LIST) {
     n = 0;
   } else {
     n = (flags & FLAGS_SIMPLE) ? nsprimitives : nprimitives;
+    if (flags & FLAGS_LEVELS_OF_DETAIL) {
+      /* The primitives of the simplified model are decoded a second time,
+         after those of the complex model, and refer to the same vertices */
+      assert(!(flags & FLAGS_SIMPLE));
+      nsimplified = nsprimitives;
+    }
+  }
+
+  /* The simplified model is only flipped if it is flat itself, as when it
+     is output alone. */
+  bool all_z_0 = (flags & FLAGS_FLIP_BACKFACING) != 0,
+       simplified_z_0 = all_z_0 && (nsimplified > 0);
+
+  /* Read all of the primitive definitions at once and decode them from
+     memory instead of reading each field separately. */
+  long int const block_start = (flags & FLAGS_VERBOSE) ? reader_ftell(r) : 0;
+  unsigned char block[MaxNumPrimitives][BytesPerPrimitive];
+  assert((size_t)n <= ARRAY_SIZE(block));
+
+  size_t const nread = reader_fread(block, BytesPerPrimitive, (size_t)n, r);
+  if (nread < (size_t)n) {
+    fprintf(stderr, "Failed to read primitive %d of object %d\n",
+            (int)nread, object_count);
+    return false;
   }
 
-  bool all_z_0 = (flags & FLAGS_FLIP_BACKFACING) != 0;
+  /* Allocate space for the generated vertices at once instead of growing
+     the vertex array one vertex at a time. */
+  int const nreserve = vertex_array_get_num_vertices(varray) +
+                       count_special_vertices(block, n, simple_dist, thick,
+                                              flags) +
+                       count_special_vertices(block, nsimplified, simple_dist,
+                                              thick, flags | FLAGS_SIMPLE);
+  if (vertex_array_alloc_vertices(varray, nreserve) < nreserve) {
+    fprintf(stderr, "Failed to allocate memory for %d vertices "
+            "(object %d)\n", nreserve, object_count);
+    return false;
+  }
 
-  for (int p = 0; p < n; ++p) {
-    const int group = p < nsprimitives ? Group_Simple : Group_Complex;
-    const long int primitive_start = reader_ftell(r);
+  for (int i = 0; i < n + nsimplified; ++i) {
+    const bool simplify = (i >= n) || (flags & FLAGS_SIMPLE);
+    const int p = i < n ? i : i - n;
+    int group = p < nsprimitives ? Group_Simple : Group_Complex;
+    if (i >= n) {
+      group = Group_Simplified;
+    }
+    if ((i == n) && (nsimplified > 0)) {
+      /* Containers for the simplified model's primitives are only searched
+         for among those primitives, as when it is output alone. */
+      container_index_set_first_group(containers, Group_Simplified);
+    }
+    bool *const flat = i < n ? &all_z_0 : &simplified_z_0;
+    unsigned char const *const primitive = block[p];
     if (flags & FLAGS_VERBOSE) {
+      const long int primitive_start = block_start +
+                                       ((long int)p * BytesPerPrimitive);
       printf("Found sides in group %d at file position %ld (0x%lx)\n",
              group, primitive_start, primitive_start);
     }
@@ -993,51 +1309,25 @@ static bool parse_primitives(Reader * const r, const int object_count,
     }
     primitive_set_id(&*pp, group_get_num_primitives((*groups) + group));
 
-    /* We need to read the primitive definition into a temporary array so
+    /* We need to copy the primitive definition into a temporary array so
        that we can get its simplification distance before validating the
        vertex indices. */
     int sides[MaxNumSides];
     int nsides;
     for (nsides = 0; nsides < MaxNumSides; ++nsides) {
-      sides[nsides] = reader_fgetc(r);
-      if (sides[nsides] == EOF) {
-        fprintf(stderr, "Failed to read side %d of primitive %d "
-                "of object %d\n", nsides, p, object_count);
-        return false;
-      }
-
+      sides[nsides] = primitive[nsides];
       if (sides[nsides] == 0) {
         break;
       }
     }
 
-    /* Skip the unused vertex indices */
-    if (reader_fseek(r, primitive_start + MaxNumSides, SEEK_SET)) {
-      fprintf(stderr, "Failed to seek end of primitive "
-              "(primitive %d of object %d)\n", p, object_count);
-      return false;
-    }
-
-    const int colour = reader_fgetc(r);
-    if (colour == EOF) {
-      fprintf(stderr, "Failed to read colour (primitive %d of object %d)\n",
-              p, object_count);
-      return false;
-    }
+    /* The colour follows the vertex indices, whether or not all of them
+       are used. */
+    const int colour = primitive[MaxNumSides];
     primitive_set_colour(&*pp, colour);
 
-    if (reader_fseek(r, PaddingBeforePrimSimpDist, SEEK_CUR)) {
-      fprintf(stderr, "Failed to seek polygon simplification distance "
-              "(primitive %d of object %d)\n", p, object_count);
-      return false;
-    }
-
-    int32_t prim_simple_dist;
-    if (!reader_fread_int32(&prim_simple_dist, r)) {
-      fprintf(stderr, "Failed to read polygon simplification distance "
-              "(primitive %d of object %d)\n", p, object_count);
-      return false;
-    }
+    const int32_t prim_simple_dist =
+      get_int32(primitive + MaxNumSides + 1 + PaddingBeforePrimSimpDist);
 
     if (prim_simple_dist < 0) {
       fprintf(stderr, "Bad polygon simplification distance, %" PRId32 " "
@@ -1050,8 +1340,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
        model's then it must be simplified whenever the model is. This
        inference prevents vertices not included in the simplified model's
        vertex count from being reported as errors. */
-    if ((flags & FLAGS_SIMPLE) && (prim_simple_dist <= simple_dist) &&
-        (nsides > 2)) {
+    if (simplify && (prim_simple_dist <= simple_dist) && (nsides > 2)) {
       nsides = 2;
       if (flags & FLAGS_VERBOSE) {
         printf("Simplifying primitive %d in group %d "
@@ -1069,7 +1358,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
         switch (v) {
         case Special8DashThinWhiteLine:
           special = true;
-          if (!make_special_dashed(varray, groups, group, 8,
+          if (!make_special_dashed(varray, groups, containers, group, 8,
                                    WhiteColour, thick, flags)) {
             fprintf(stderr, "Failed to make a thin dashed line "
                     "(primitive %d of object %d)\n", p, object_count);
@@ -1079,7 +1368,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
 
         case Special16DashThinWhiteLine:
           special = true;
-          if (!make_special_dashed(varray, groups, group, 16,
+          if (!make_special_dashed(varray, groups, containers, group, 16,
                                    WhiteColour, thick, flags)) {
             fprintf(stderr, "Failed to make a thin dashed line "
                     "(primitive %d of object %d)\n", p, object_count);
@@ -1089,7 +1378,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
 
         case Special32DashThickWhiteLine:
           special = true;
-          if (!make_special_dashed(varray, groups, group, 32,
+          if (!make_special_dashed(varray, groups, containers, group, 32,
                                    WhiteColour, thick*2, flags)) {
             fprintf(stderr, "Failed to make a thick dashed line "
                     "(primitive %d of object %d)\n", p, object_count);
@@ -1116,7 +1405,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
 
         case Special16DarkGreyQuads:
           special = true;
-          if (!make_special_quads(varray, groups, group, 16,
+          if (!make_special_quads(varray, groups, containers, group, 16,
                                   DarkGreyColour, flags)) {
             fprintf(stderr, "Failed to make a row of parallelograms "
                     "(primitive %d of object %d)\n", p, object_count);
@@ -1126,7 +1415,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
 
         case Special64ThickPeruLines:
           special = true;
-          if (!make_special_hatch(varray, groups, group, 64,
+          if (!make_special_hatch(varray, groups, containers, group, 64,
                                   PeruColour, thick*2, flags)) {
             fprintf(stderr, "Failed to make a hatched region "
                     "(primitive %d of object %d)\n", p, object_count);
@@ -1147,7 +1436,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
         case Special8PeridotQuadsCheckZ:
         case Special8PeridotQuads:
           special = true;
-          if (!make_special_quads(varray, groups, group, 8,
+          if (!make_special_quads(varray, groups, containers, group, 8,
                                   PeridotColour, flags)) {
             fprintf(stderr, "Failed to make a row of parallelograms "
                     "(primitive %d of object %d)\n", p, object_count);
@@ -1158,7 +1447,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
         case Special16WhiteQuadsCheckZ:
         case Special16WhiteQuads:
           special = true;
-          if (!make_special_quads(varray, groups, group, 16,
+          if (!make_special_quads(varray, groups, containers, group, 16,
                                   WhiteColour, flags)) {
             fprintf(stderr, "Failed to make a row of parallelograms "
                     "(primitive %d of object %d)\n", p, object_count);
@@ -1179,8 +1468,9 @@ static bool parse_primitives(Reader * const r, const int object_count,
         break;
       }
 
-      /* Validate the vertex indices */
-      if (v < 1 || v > nvertices) {
+      /* Validate the vertex indices. The simplified model's primitives
+         may only refer to vertices included in its own vertex count. */
+      if (v < 1 || v > (i < n ? nvertices : nsvertices)) {
         fprintf(stderr, "Bad vertex %lld (side %d of primitive %d "
                 "of object %d)\n", (long long signed)v - 1, s, p,
                 object_count);
@@ -1190,14 +1480,25 @@ static bool parse_primitives(Reader * const r, const int object_count,
       /* Vertex indices are stored using offset-1 encoding */
       --v;
 
-      if (all_z_0) {
-        _Optional Coord (* const coords)[3] = vertex_array_get_coords(varray, v);
-        if (!coords) {
-          return false;
-        }
-        if (!coord_equal((*coords)[2], 0)) {
-          DEBUGF("Not a flat object (vertex %d, z==%g)\n", v, (*coords)[2]);
-          all_z_0 = false;
+      if (*flat) {
+        if (v < nfile) {
+          /* Vertices read from the file have exact integer coordinates */
+          if (file_coords[v][2] != 0) {
+            DEBUGF("Not a flat object (vertex %d, z==%" PRId32 ")\n", v,
+                   file_coords[v][2]);
+            *flat = false;
+          }
+        } else {
+          _Optional Coord (* const coords)[3] =
+            vertex_array_get_coords(varray, v);
+          if (!coords) {
+            return false;
+          }
+          if (!coord_equal((*coords)[2], 0)) {
+            DEBUGF("Not a flat object (vertex %d, z==%g)\n", v,
+                   (*coords)[2]);
+            *flat = false;
+          }
         }
       }
 
@@ -1233,7 +1534,7 @@ static bool parse_primitives(Reader * const r, const int object_count,
 
       if ((num_sides == 2) && (thick > 0)) {
         /* Thicken a line if it is coplanar with a polygon. */
-        if (!thicken_line(varray, groups, group, thick, flags)) {
+        if (!thicken_line(varray, groups, containers, group, thick, flags)) {
           fprintf(stderr, "Failed to thicken a line "
                           "(primitive %d of object %d)\n", p, object_count);
           return false;
@@ -1261,7 +1562,14 @@ static bool parse_primitives(Reader * const r, const int object_count,
      belonging to objects coplanar with z=0). The game disables backface
      culling for arbitrary objects so we have to use an heuristic instead. */
   if (all_z_0) {
-    flip_backfacing(varray, groups, flags);
+    flip_backfacing(varray, groups, Group_Simple, Group_Complex, flags);
+  }
+  if (simplified_z_0) {
+    flip_backfacing(varray, groups, Group_Simplified, Group_Simplified,
+                    flags);
+  }
+  if (all_z_0 || simplified_z_0) {
+    container_index_clear(containers);
   }
   return true;
 }
@@ -1336,10 +1644,44 @@ static int get_false_colour(const Primitive *pp, void *arg)
   return colour;
 }
 
+static void init_material_names(void)
+{
+  for (int colour = 0; colour < NColours; ++colour) {
+    MaterialName *const m = &material_names[colour];
+    m->len = snprintf(m->name, sizeof(m->name), "riscos_%d", colour);
+    assert(m->len > 0);
+    assert((size_t)m->len < sizeof(m->name));
+
+    MaterialName *const h = &human_material_names[colour];
+    h->len = snprintf(h->name, sizeof(h->name), "%s_%d",
+                      get_colour_name(colour / NTints), colour % NTints);
+    assert(h->len > 0);
+    assert((size_t)h->len < sizeof(h->name));
+  }
+}
+
+static int copy_material_name(char *const buf, size_t const buf_size,
+                              MaterialName const *const m)
+{
+  assert(m != NULL);
+
+  /* Same result as snprintf */
+  if (buf_size > 0) {
+    size_t const n = (size_t)m->len < buf_size ? (size_t)m->len :
+                                                 buf_size - 1;
+    memcpy(buf, m->name, n);
+    buf[n] = '\0';
+  }
+  return m->len;
+}
+
 static int get_human_material(char *buf, size_t buf_size,
                               int const colour, void *arg)
 {
   NOT_USED(arg);
+  if ((colour >= 0) && (colour < NColours)) {
+    return copy_material_name(buf, buf_size, &human_material_names[colour]);
+  }
   return snprintf(buf, buf_size, "%s_%d",
                   get_colour_name(colour / NTints), colour % NTints);
 }
@@ -1348,102 +1690,88 @@ static int get_material(char *const buf, size_t const buf_size,
                         int const colour, void *arg)
 {
   NOT_USED(arg);
+  if ((colour >= 0) && (colour < NColours)) {
+    return copy_material_name(buf, buf_size, &material_names[colour]);
+  }
   return snprintf(buf, buf_size, "riscos_%d", colour);
 }
 
-static bool process_object(Reader * const r, FILE * const out,
-                           const char * const object_name,
-                           const int object_count,
-                           VertexArray * const varray,
-                           Group (* const groups)[Group_Count],
-                           int *const vtotal, bool *const list_title,
-                           Coord const thick, long int const data_start,
-                           const unsigned int flags)
+static int get_no_colour(const Primitive *pp, void *arg)
 {
-  long int obj_start = 0;
+  NOT_USED(pp);
+  NOT_USED(arg);
+  return 0;
+}
 
+static bool parse_header(Reader * const r, const int object_count,
+                         ObjectHeader * const hdr)
+{
   assert(r != NULL);
   assert(!reader_ferror(r));
-  assert(object_name != NULL);
-  assert(*object_name != '\0');
   assert(object_count >= 0);
-  assert(groups != NULL);
-  assert(vtotal != NULL);
-  assert(*vtotal >= 0);
-  assert(thick >= 0);
-  assert(data_start >= 0);
-  assert(!(flags & ~FLAGS_ALL));
-
-  if (flags & FLAGS_LIST) {
-    obj_start = reader_ftell(r);
-  }
+  assert(hdr != NULL);
 
-  int32_t simple_dist;
-  if (!reader_fread_int32(&simple_dist, r)) {
+  if (!reader_fread_int32(&hdr->simple_dist, r)) {
     fprintf(stderr, "Failed to read simplification distance (object %d)\n",
             object_count);
     return false;
   }
-  if (simple_dist < 0) {
+  if (hdr->simple_dist < 0) {
     fprintf(stderr, "Bad simplification distance, %" PRId32 " (object %d)\n",
-            simple_dist, object_count);
+            hdr->simple_dist, object_count);
     return false;
   }
 
-  int32_t nprimitives;
-  if (!reader_fread_int32(&nprimitives, r)) {
+  if (!reader_fread_int32(&hdr->nprimitives, r)) {
     fprintf(stderr, "Failed to read number of primitives (object %d)\n",
             object_count);
     return false;
   }
 
-  if (nprimitives >= MaxNumPrimitives) {
+  if (hdr->nprimitives >= MaxNumPrimitives) {
     fprintf(stderr, "Bad number of primitives, %lld (object %d)\n",
-            (long long signed int)nprimitives + 1, object_count);
+            (long long signed int)hdr->nprimitives + 1, object_count);
     return false;
   }
-  ++nprimitives;
+  ++hdr->nprimitives;
 
-  int32_t nvertices;
-  if (!reader_fread_int32(&nvertices, r)) {
+  if (!reader_fread_int32(&hdr->nvertices, r)) {
     fprintf(stderr, "Failed to read number of vertices (object %d)\n",
             object_count);
     return false;
   }
-  if (nvertices < 0 || nvertices >= MaxNumVertices) {
+  if (hdr->nvertices < 0 || hdr->nvertices >= MaxNumVertices) {
     fprintf(stderr, "Bad number of vertices, %lld (object %d)\n",
-            (long long signed int)nvertices + 1, object_count);
+            (long long signed int)hdr->nvertices + 1, object_count);
     return false;
   }
-  ++nvertices;
+  ++hdr->nvertices;
 
-  int32_t nsprimitives;
-  if (!reader_fread_int32(&nsprimitives, r)) {
+  if (!reader_fread_int32(&hdr->nsprimitives, r)) {
     fprintf(stderr, "Failed to read simplified number of primitives "
             "(object %d)\n", object_count);
     return false;
   }
-  if (nsprimitives >= nprimitives) {
+  if (hdr->nsprimitives >= hdr->nprimitives) {
     fprintf(stderr, "Bad simplified number of primitives, %lld "
-            "(object %d)\n", (long long signed int)nsprimitives + 1,
+            "(object %d)\n", (long long signed int)hdr->nsprimitives + 1,
             object_count);
     return false;
   }
-  ++nsprimitives;
+  ++hdr->nsprimitives;
 
-  int32_t nsvertices;
-  if (!reader_fread_int32(&nsvertices, r)) {
+  if (!reader_fread_int32(&hdr->nsvertices, r)) {
     fprintf(stderr, "Failed to read simplified number of vertices "
             "(object %d)\n", object_count);
     return false;
   }
-  if (nsvertices < 0 || nsvertices >= nvertices) {
+  if (hdr->nsvertices < 0 || hdr->nsvertices >= hdr->nvertices) {
     fprintf(stderr, "Bad simplified number of vertices, %lld "
-            "(object %d)\n", (long long signed int)nsvertices + 1,
+            "(object %d)\n", (long long signed int)hdr->nsvertices + 1,
             object_count);
     return false;
   }
-  ++nsvertices;
+  ++hdr->nsvertices;
 
   if (reader_fseek(r, PaddingBeforeClipDist, SEEK_CUR)) {
     fprintf(stderr, "Failed to seek clip distance (object %d)\n",
@@ -1451,174 +1779,1705 @@ static bool process_object(Reader * const r, FILE * const out,
     return false;
   }
 
-  int32_t clip_dist;
-  if (!reader_fread_int32(&clip_dist, r)) {
+  if (!reader_fread_int32(&hdr->clip_dist, r)) {
     fprintf(stderr, "Failed to read clip distance (object %d)\n",
             object_count);
     return false;
   }
-  if (clip_dist < 0) {
+  if (hdr->clip_dist < 0) {
     fprintf(stderr, "Bad clip distance, %" PRId32 " (object %d)\n",
-            clip_dist, object_count);
+            hdr->clip_dist, object_count);
     return false;
   }
 
-  int32_t primitive_style;
-  if (!reader_fread_int32(&primitive_style, r)) {
+  if (!reader_fread_int32(&hdr->primitive_style, r)) {
     fprintf(stderr, "Failed to read primitive style (object %d)\n",
             object_count);
     return false;
   }
-  if ((primitive_style != Outline_None) &&
-      (primitive_style != Outline_Black) &&
-      (primitive_style != Outline_Blue)) {
+  if ((hdr->primitive_style != Outline_None) &&
+      (hdr->primitive_style != Outline_Black) &&
+      (hdr->primitive_style != Outline_Blue)) {
     fprintf(stderr, "Bad primitive style, %" PRId32 " (object %d)\n",
-            primitive_style, object_count);
+            hdr->primitive_style, object_count);
     return false;
   }
 
+  return true;
+}
+
+static bool parse_object(Reader * const r, const int object_count,
+                         ObjectHeader const * const hdr,
+                         VertexArray * const varray,
+                         Group (* const groups)[Group_Count],
+                         ContainerIndex * const containers,
+                         Coord const thick, const unsigned int flags)
+{
+  assert(r != NULL);
+  assert(object_count >= 0);
+  assert(hdr != NULL);
+  assert(groups != NULL);
+  assert(containers != NULL);
+  assert(thick >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
   vertex_array_clear(varray);
 
-  if (!parse_vertices(r, object_count, varray,
-                      nvertices, nsvertices, flags)) {
+  /* Original coordinates of the vertices read from the file, which are
+     only converted to floating point when added to the vertex array. */
+  int32_t file_coords[MaxNumVertices][3];
+  if (!parse_vertices(r, object_count, varray, file_coords,
+                      hdr->nvertices, hdr->nsvertices, flags)) {
     return false;
   }
+  int const nfile = vertex_array_get_num_vertices(varray);
 
   for (int g = 0; g < Group_Count; ++g) {
     group_delete_all((*groups) + g);
   }
+  container_index_set_first_group(containers, Group_Simple);
 
   /* Objects 37 and 38 have bad primitive counts */
-  if ((nprimitives > 0) && (nsprimitives > 0)) {
-    if (!parse_primitives(r, object_count, varray, groups, simple_dist,
-                          nprimitives, nsprimitives, thick, flags)) {
+  if ((hdr->nprimitives > 0) && (hdr->nsprimitives > 0)) {
+    if (!parse_primitives(r, object_count, varray, file_coords, nfile,
+                          groups, containers, hdr->simple_dist,
+                          hdr->nprimitives, hdr->nsprimitives,
+                          hdr->nsvertices, thick, flags)) {
       return false;
     }
   }
 
-  if (out != NULL) {
-    /* In cases of overlapping coplanar polygons,
-       split the underlying polygon */
-    if (flags & FLAGS_CLIP_POLYGONS) {
-      const int group_order[] = {Group_Simple, Group_Complex};
-      if (!clip_polygons(varray, *groups, group_order,
-                         ARRAY_SIZE(group_order),
-                         (flags & FLAGS_VERBOSE) != 0)) {
-        fprintf(stderr,
-                "Clipping of overlapping coplanar polygons failed\n");
-        return false;
-      }
-    }
+  return true;
+}
 
-    /* Mark the vertices in preparation for culling unused ones. */
-    mark_vertices(varray, groups, object_count, flags);
+static _Optional Primitive *copy_primitive(Group * const group,
+                                           Primitive const * const pp,
+                                           const int p,
+                                           const int object_count)
+{
+  assert(group != NULL);
+  assert(pp != NULL);
+
+  /* The sides are left for the caller to add */
+  _Optional Primitive *const copy = group_add_primitive(group);
+  if (copy == NULL) {
+    fprintf(stderr, "Failed to allocate primitive memory for copy "
+            "(primitive %d of object %d)\n", p, object_count);
+    return NULL;
+  }
+  primitive_set_id(&*copy, primitive_get_id(pp));
+  primitive_set_colour(&*copy, primitive_get_colour(pp));
+  return copy;
+}
 
-    if (!(flags & FLAGS_DUPLICATE)) {
-      /* Unmark duplicate vertices in preparation for culling them. */
-      if (vertex_array_find_duplicates(varray,
-                                       (flags & FLAGS_VERBOSE) != 0) < 0) {
-        fprintf(stderr, "Detection of duplicate vertices failed\n");
-        return false;
+static bool sort_by_material(Group (* const groups)[Group_Count],
+                             const int object_count,
+                             const unsigned int flags)
+{
+  assert(groups != NULL);
+  assert(object_count >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* Each material has its own colour, so sorting primitives by colour
+     minimises the number of material changes. Groups aren't merged, so
+     the painter's algorithm still draws Group_Simple before
+     Group_Complex. */
+  for (int g = 0; g < Group_Count; ++g) {
+    Group *const group = (*groups) + g;
+    int const n = group_get_num_primitives(group);
+    if (n < 2) {
+      continue;
+    }
+
+    int count[NColours] = {0};
+    for (int p = 0; p < n; ++p) {
+      _Optional Primitive *const pp = group_get_primitive(group, p);
+      if (pp) {
+        int const colour = primitive_get_colour(&*pp);
+        assert(colour >= 0);
+        assert(colour < NColours);
+        ++count[colour];
       }
     }
 
-    int vobject;
-    if (!(flags & FLAGS_UNUSED) || !(flags & FLAGS_DUPLICATE)) {
-      /* Cull unused and/or duplicate vertices */
-      vobject = vertex_array_renumber(varray, (flags & FLAGS_VERBOSE) != 0);
-      DEBUGF("Renumbered %d vertices\n", vobject);
-    } else {
-      vobject = vertex_array_get_num_vertices(varray);
-      DEBUGF("No need to renumber %d vertices\n", vobject);
+    /* Copy the primitives of each colour in turn, keeping their original
+       order. Most groups have few colours, so this is quicker than it
+       looks. */
+    Group sorted;
+    group_init(&sorted);
+    bool success = true;
+    for (int colour = 0; success && (colour < NColours); ++colour) {
+      for (int p = 0; success && (count[colour] > 0) && (p < n); ++p) {
+        _Optional Primitive *const pp = group_get_primitive(group, p);
+        if (!pp || (primitive_get_colour(&*pp) != colour)) {
+          continue;
+        }
+        --count[colour];
+
+        _Optional Primitive *const copy = copy_primitive(&sorted, &*pp, p,
+                                                         object_count);
+        if (copy == NULL) {
+          success = false;
+          break;
+        }
+
+        int const nsides = primitive_get_num_sides(&*pp);
+        for (int s = 0; s < nsides; ++s) {
+          if (primitive_add_side(&*copy, primitive_get_side(&*pp, s)) < 0) {
+            fprintf(stderr, "Failed to add side: too many sides? "
+                            "(side %d of primitive %d of object %d)\n",
+                    s, p, object_count);
+            success = false;
+            break;
+          }
+        }
+      }
     }
 
-    if (fprintf(out, "\no %s\n"
-                     "# Simplification distance: %" PRId32 "\n"
-                     "# Clip distance: %" PRId32 "\n"
-                     "# Primitive style: %s\n",
-               object_name, simple_dist, clip_dist,
-               style_to_string(primitive_style)) < 0) {
-      fprintf(stderr,
-              "Failed writing to output file: %s\n",
-              strerror(errno));
+    if (!success) {
+      group_free(&sorted);
       return false;
     }
 
-    VertexStyle vstyle = VertexStyle_Positive;
-    if (flags & FLAGS_NEGATIVE_INDICES) {
-      vstyle = VertexStyle_Negative;
+    if (flags & FLAGS_VERBOSE) {
+      printf("Sorted %d primitives in group %d by material\n", n, g);
     }
 
-    MeshStyle mstyle = MeshStyle_NoChange;
-    if (flags & FLAGS_TRIANGLE_FANS) {
-      mstyle = MeshStyle_TriangleFan;
-    } else if (flags & FLAGS_TRIANGLE_STRIPS) {
-      mstyle = MeshStyle_TriangleStrip;
+    /* Replace the original group with the sorted copy */
+    Group const unsorted = *group;
+    *group = sorted;
+    sorted = unsorted;
+    group_free(&sorted);
+  }
+
+  return true;
+}
+
+static bool prepare_object(VertexArray * const varray,
+                           Group (* const groups)[Group_Count],
+                           Arena * const arena,
+                           const int object_count, int * const vobject,
+                           const unsigned int flags)
+{
+  assert(groups != NULL);
+  assert(arena != NULL);
+  assert(object_count >= 0);
+  assert(vobject != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* Scratch memory used for the previous object is no longer needed */
+  arena_reset(arena);
+
+  /* In cases of overlapping coplanar polygons,
+     split the underlying polygon (unless there are none, in which case
+     only the verbose output would differ). */
+  if ((flags & FLAGS_CLIP_POLYGONS) &&
+      ((flags & FLAGS_VERBOSE) ||
+       may_overlap(varray, *groups, Group_Simplified, arena))) {
+    const int group_order[] = {Group_Simple, Group_Complex};
+    if (!clip_polygons(varray, *groups, group_order,
+                       ARRAY_SIZE(group_order),
+                       (flags & FLAGS_VERBOSE) != 0)) {
+      fprintf(stderr,
+              "Clipping of overlapping coplanar polygons failed\n");
+      return false;
     }
+  }
 
-    if (!output_vertices(out, vobject, varray, -1) ||
-        !output_primitives(out, object_name, *vtotal, vobject,
-                           varray, *groups, ARRAY_SIZE(*groups),
-                           (flags & FLAGS_FALSE_COLOUR) ?
-                             get_false_colour : (OutputPrimitivesGetColourFn *)NULL,
-                           (flags & FLAGS_HUMAN_READABLE) ?
-                             get_human_material : get_material,
-                           (void *)NULL, vstyle, mstyle)) {
-      fprintf(stderr, "Failed writing to output file: %s\n",
-              strerror(errno));
+  /* The simplified model is drawn instead of the complex model, so its
+     polygons are clipped only against each other. */
+  if ((flags & FLAGS_CLIP_POLYGONS) &&
+      (flags & FLAGS_LEVELS_OF_DETAIL) &&
+      ((flags & FLAGS_VERBOSE) ||
+       may_overlap(varray, *groups + Group_Simplified, 1, arena))) {
+    const int group_order[] = {Group_Simplified};
+    if (!clip_polygons(varray, *groups, group_order,
+                       ARRAY_SIZE(group_order),
+                       (flags & FLAGS_VERBOSE) != 0)) {
+      fprintf(stderr,
+              "Clipping of overlapping coplanar polygons failed\n");
       return false;
     }
+  }
 
-    *vtotal += vobject;
+  /* Sorting must follow clipping, which relies on the order in which
+     primitives are drawn. */
+  if ((flags & FLAGS_SORT_MATERIALS) &&
+      !sort_by_material(groups, object_count, flags)) {
+    return false;
   }
 
-  if (flags & FLAGS_LIST) {
-    if (!*list_title) {
-      puts("\nIndex  Name          Verts  Prims  SimpV  SimpP      "
-           "Offset        Size");
-      *list_title = true;
+  /* Mark the vertices in preparation for culling unused ones. */
+  mark_vertices(varray, groups, object_count, flags);
+
+  if (!(flags & FLAGS_DUPLICATE)) {
+    /* Unmark duplicate vertices in preparation for culling them. */
+    if (find_duplicates(varray, arena, (flags & FLAGS_VERBOSE) != 0) < 0) {
+      fprintf(stderr, "Detection of duplicate vertices failed\n");
+      return false;
     }
+  }
 
-    const long int obj_size = reader_ftell(r) - obj_start;
-    printf("%5d  %-12.12s  %5d  %5d  %5d  %5d  %10ld  %10ld\n",
-           object_count, object_name, nvertices, nprimitives, nsvertices,
-           nsprimitives, data_start + obj_start, obj_size);
+  if (!(flags & FLAGS_UNUSED) || !(flags & FLAGS_DUPLICATE)) {
+    /* Cull unused and/or duplicate vertices */
+    *vobject = vertex_array_renumber(varray, (flags & FLAGS_VERBOSE) != 0);
+    DEBUGF("Renumbered %d vertices\n", *vobject);
+  } else {
+    *vobject = vertex_array_get_num_vertices(varray);
+    DEBUGF("No need to renumber %d vertices\n", *vobject);
   }
 
   return true;
 }
 
-bool choc_to_obj(Reader * const index, Reader * const models,
-                 FILE * const out, const int first, const int last,
-                 _Optional const char * const name, const long int data_start,
-                 const char * const mtl_file, double const thick,
-                 const unsigned int flags)
+static _Optional FILE *scratch_file_open(ScratchFile * const scratch)
 {
-  bool success = true;
-  Group groups[Group_Count];
-  for (int g = 0; g < Group_Count; ++g) {
-    group_init(groups + g);
+  assert(scratch != NULL);
+
+  if (scratch->f == NULL) {
+    scratch->f = tmpfile();
+    if (scratch->f == NULL) {
+      fprintf(stderr, "Failed to create temporary file: %s\n",
+              strerror(errno));
+      return NULL;
+    }
+  } else {
+    /* Data left from a previous object is overwritten; only the amount
+       subsequently written is read back. */
+    rewind(&*scratch->f);
   }
-  VertexArray varray;
-  vertex_array_init(&varray);
-  int vtotal = 0;
+  return scratch->f;
+}
 
-  assert(index != NULL);
-  assert(!reader_ferror(index));
-  assert(models != NULL);
+static void scratch_file_close(ScratchFile * const scratch)
+{
+  assert(scratch != NULL);
+
+  if (scratch->f != NULL) {
+    fclose(&*scratch->f);
+    scratch->f = NULL;
+  }
+}
+
+static bool copy_coloured_object(FILE * const out, FILE * const tmp,
+                                 long int size, int const nvertices,
+                                 int const * const colours)
+{
+  assert(out != NULL);
+  assert(tmp != NULL);
+  assert(size >= 0);
+  assert(nvertices >= 0);
+  assert(colours != NULL);
+
+  /* Colour components are appended to each vertex definition (a
+     widely-supported extension of the OBJ format) and material statements
+     are removed because no material library is referenced. */
+  int v = 0;
+  bool line_start = true, is_vertex = false, is_material = false;
+  char line[VertexLineSize];
+  while ((size > 0) &&
+         fgets(line, size < (long)sizeof(line) ? (int)size + 1 :
+                                                 (int)sizeof(line), tmp)) {
+    /* A long line may be read in more than one part */
+    size_t len = strlen(line);
+    size -= (long)len;
+    if (line_start) {
+      is_vertex = !strncmp(line, "v ", 2);
+      is_material = !strncmp(line, "usemtl ", 7);
+    }
+    line_start = (len > 0) && (line[len - 1] == '\n');
+
+    if (is_material) {
+      continue;
+    }
+
+    if (line_start && is_vertex) {
+      --len;
+    }
+
+    if (fwrite(line, 1, len, out) != len) {
+      return false;
+    }
+
+    if (line_start && is_vertex) {
+      assert(v < nvertices);
+      double rgb[3];
+      get_colour_rgb(colours[v++], &rgb);
+      if (fprintf(out, " %f %f %f\n", rgb[0], rgb[1], rgb[2]) < 0) {
+        return false;
+      }
+    }
+  }
+
+  return !ferror(tmp);
+}
+
+static bool write_object(FILE * const out, ScratchFile * const scratch,
+                         const char * const object_name,
+                         ObjectHeader const * const hdr,
+                         int const vtotal, int const vobject,
+                         VertexArray const * const vnew, int const nnew,
+                         _Optional int const * const vcolours,
+                         VertexArray * const varray,
+                         Group (* const groups)[Group_Count],
+                         const unsigned int flags)
+{
+  assert(out != NULL);
+  assert(scratch != NULL);
+  assert(object_name != NULL);
+  assert(*object_name != '\0');
+  assert(hdr != NULL);
+  assert(vtotal >= 0);
+  assert(vobject >= 0);
+  assert(vnew != NULL);
+  assert(nnew >= 0);
+  assert((vcolours == NULL) == !(flags & FLAGS_VERTEX_COLOURS));
+  assert(groups != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  if (fprintf(out, "\no %s\n"
+                   "# Simplification distance: %" PRId32 "\n"
+                   "# Clip distance: %" PRId32 "\n"
+                   "# Primitive style: %s\n",
+             object_name, hdr->simple_dist, hdr->clip_dist,
+             style_to_string(hdr->primitive_style)) < 0) {
+    fprintf(stderr,
+            "Failed writing to output file: %s\n",
+            strerror(errno));
+    return false;
+  }
+
+  VertexStyle vstyle = VertexStyle_Positive;
+  if (flags & FLAGS_NEGATIVE_INDICES) {
+    vstyle = VertexStyle_Negative;
+  }
+
+  MeshStyle mstyle = MeshStyle_NoChange;
+  if (flags & FLAGS_TRIANGLE_FANS) {
+    mstyle = MeshStyle_TriangleFan;
+  } else if (flags & FLAGS_TRIANGLE_STRIPS) {
+    mstyle = MeshStyle_TriangleStrip;
+  }
+
+  OutputPrimitivesGetColourFn *get_colour =
+    (flags & FLAGS_FALSE_COLOUR) ? get_false_colour :
+                                   (OutputPrimitivesGetColourFn *)NULL;
+
+  OutputPrimitivesGetMaterialFn *const get_mtl =
+    (flags & FLAGS_HUMAN_READABLE) ? get_human_material : get_material;
+
+  /* If colours are output as part of the vertices then the object is
+     written to a scratch file first, so that the vertex definitions
+     formatted by the library can be extended and the material statements
+     removed. Every face has the same colour to minimise the number of
+     material statements. */
+  FILE *dest = out;
+  if (vcolours != NULL) {
+    get_colour = get_no_colour;
+    _Optional FILE *const tmp = scratch_file_open(scratch);
+    if (tmp == NULL) {
+      return false;
+    }
+    dest = &*tmp;
+  }
+
+  bool success = output_vertices(dest, nnew, vnew, -1) &&
+                 output_primitives(dest, object_name, vtotal, vobject,
+                                   varray, *groups, Group_Simplified,
+                                   get_colour, get_mtl, (void *)NULL, vstyle,
+                                   mstyle);
+
+  if (success && (flags & FLAGS_LEVELS_OF_DETAIL)) {
+    /* The simplified model is a separate object whose faces refer to the
+       vertices already output for the complex model. */
+    char simple_name[MaxObjectNameLen + sizeof("_simple")];
+    sprintf(simple_name, "%.*s_simple", MaxObjectNameLen - 1, object_name);
+
+    success = fprintf(dest, "\no %s\n"
+                            "# Level of detail of: %s\n"
+                            "# Switch distance: %" PRId32 "\n"
+                            "# Clip distance: %" PRId32 "\n",
+                      simple_name, object_name, hdr->simple_dist,
+                      hdr->clip_dist) >= 0 &&
+              output_primitives(dest, simple_name, vtotal, vobject,
+                                varray, *groups + Group_Simplified, 1,
+                                get_colour, get_mtl, (void *)NULL, vstyle,
+                                mstyle);
+  }
+
+  if (success && (dest != out)) {
+    long int const size = ftell(dest);
+    success = (size >= 0) && !fseek(dest, 0, SEEK_SET) &&
+              copy_coloured_object(out, dest, size, nnew, &*vcolours);
+  }
+
+  if (!success) {
+    fprintf(stderr, "Failed writing to output file: %s\n",
+            strerror(errno));
+  }
+  return success;
+}
+
+static bool write_header(FILE * const out, const char * const mtl_file,
+                         const unsigned int flags)
+{
+  assert(out != NULL);
+  assert(mtl_file != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* The material library isn't needed if colours are output as part of
+     each vertex. */
+  if ((fprintf(out, "# Chocks Away graphics\n"
+                    "# Converted by ChoctoObj "VERSION_STRING"\n") < 0) ||
+      (!(flags & FLAGS_VERTEX_COLOURS) &&
+       (fprintf(out, "mtllib %s\n", mtl_file) < 0))) {
+    fprintf(stderr, "Failed writing to output file: %s\n",
+            strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static bool write_headers(int const nout, OutputVariant const out[],
+                          const char * const mtl_file,
+                          const unsigned int flags)
+{
+  assert(nout >= 0);
+  assert(out != NULL);
+
+  for (int v = 0; v < nout; ++v) {
+    if (!write_header(out[v].out, mtl_file, flags)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool write_object_file(const char * const out_dir,
+                              ScratchFile * const scratch,
+                              const char * const mtl_file,
+                              const char * const object_name,
+                              const int object_count,
+                              ObjectHeader const * const hdr,
+                              int const vobject,
+                              VertexArray * const varray,
+                              _Optional int const * const vcolours,
+                              Group (* const groups)[Group_Count],
+                              const unsigned int flags)
+{
+  assert(out_dir != NULL);
+  assert(mtl_file != NULL);
+  assert(object_name != NULL);
+  assert(object_count >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* The object number makes the temporary file name unique even if
+     several objects have the same name. */
+  char file_name[FILENAME_MAX], tmp_name[FILENAME_MAX];
+  int len = snprintf(file_name, sizeof(file_name), "%s%c%s%cobj", out_dir,
+                     PATH_SEPARATOR, object_name, EXTENSION_SEPARATOR);
+  if ((len >= 0) && ((size_t)len < sizeof(file_name))) {
+    len = snprintf(tmp_name, sizeof(tmp_name), "%s%ctmp%d", file_name,
+                   EXTENSION_SEPARATOR, object_count);
+  }
+  if ((len < 0) || ((size_t)len >= sizeof(tmp_name))) {
+    fprintf(stderr, "Output file name for object %d is too long\n",
+            object_count);
+    return false;
+  }
+
+  if (flags & FLAGS_VERBOSE) {
+    printf("Writing object %d to output file '%s'\n", object_count,
+           file_name);
+  }
+
+  _Optional FILE *const out = fopen(tmp_name, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Failed to open output file '%s': %s\n",
+            tmp_name, strerror(errno));
+    return false;
+  }
+
+  bool success = write_header(&*out, mtl_file, flags) &&
+                 write_object(&*out, scratch, object_name, hdr, 0, vobject,
+                              varray, vobject, vcolours, varray, groups,
+                              flags);
+
+  if (fclose(&*out)) {
+    fprintf(stderr, "Failed to close output file '%s': %s\n",
+            tmp_name, strerror(errno));
+    success = false;
+  }
+
+  /* The output file only appears once it is complete, so an interrupted
+     conversion never leaves a partial object behind. ISO C doesn't say
+     whether rename replaces an existing file, so if the destination exists
+     then try again without it (which is not atomic). Any other failure
+     leaves the existing file untouched. */
+  if (success && rename(tmp_name, file_name)) {
+    int rename_errno = errno;
+    bool renamed = false;
+    _Optional FILE *const existing = fopen(file_name, "r");
+    if (existing != NULL) {
+      fclose(&*existing);
+      if (!remove(file_name) && !rename(tmp_name, file_name)) {
+        renamed = true;
+      } else {
+        rename_errno = errno;
+      }
+    }
+
+    if (!renamed) {
+      fprintf(stderr, "Failed to rename output file '%s' as '%s': %s\n",
+              tmp_name, file_name, strerror(rename_errno));
+      success = false;
+    }
+  }
+
+  if (!success) {
+    remove(tmp_name);
+  }
+  return success;
+}
+
+static bool pool_vertex(PooledOutput * const pool,
+                        VertexArray const * const varray, int const v,
+                        int * const pv, const int object_count)
+{
+  assert(pool != NULL);
+  assert(pv != NULL);
+
+  _Optional Coord (* const coords)[3] = vertex_array_get_coords(varray, v);
+  if (!coords) {
+    return false;
+  }
+
+  *pv = vertex_pool_find(&pool->vertices, &*coords);
+  if (*pv < 0) {
+    fprintf(stderr, "Failed to allocate memory for vertex pool "
+            "(vertex %d of object %d)\n", v, object_count);
+    return false;
+  }
+  return true;
+}
+
+static bool pool_object(PooledOutput * const pool,
+                        VertexArray const * const varray,
+                        Group (* const groups)[Group_Count],
+                        const int object_count, const unsigned int flags)
+{
+  assert(pool != NULL);
+  assert(groups != NULL);
+  assert(object_count >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  vertex_pool_begin(&pool->vertices);
+
+  if (flags & FLAGS_UNUSED) {
+    /* Unreferenced vertices are pooled in their original order */
+    int const nvertices = vertex_array_get_num_vertices(varray);
+    for (int v = 0; v < nvertices; ++v) {
+      int pv;
+      if (!pool_vertex(pool, varray, v, &pv, object_count)) {
+        return false;
+      }
+    }
+  }
+
+  /* Vertices are matched by their coordinates, so any duplicate vertices
+     in the object refer to the same vertex in the pool. */
+  for (int g = 0; g < Group_Count; ++g) {
+    Group *const pgroup = pool->groups + g;
+    group_delete_all(pgroup);
+
+    int const n = group_get_num_primitives((*groups) + g);
+    for (int p = 0; p < n; ++p) {
+      _Optional Primitive *const pp = group_get_primitive((*groups) + g, p);
+      if (!pp) {
+        continue;
+      }
+
+      _Optional Primitive *const copy = copy_primitive(pgroup, &*pp, p,
+                                                       object_count);
+      if (copy == NULL) {
+        return false;
+      }
+
+      int const nsides = primitive_get_num_sides(&*pp);
+      for (int s = 0; s < nsides; ++s) {
+        int pv;
+        if (!pool_vertex(pool, varray, primitive_get_side(&*pp, s), &pv,
+                         object_count)) {
+          return false;
+        }
+        if (primitive_add_side(&*copy, pv) < 0) {
+          fprintf(stderr, "Failed to add side: too many sides? "
+                          "(side %d of primitive %d of object %d)\n",
+                  s, p, object_count);
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static void coloured_object_init(ColouredObject * const coloured)
+{
+  assert(coloured != NULL);
+
+  vertex_pool_init(&coloured->positions);
+  vertex_array_init(&coloured->varray);
+  for (int g = 0; g < Group_Count; ++g) {
+    group_init(coloured->groups + g);
+  }
+  coloured->colours = coloured->first = coloured->next = NULL;
+}
+
+static void coloured_object_free(ColouredObject * const coloured)
+{
+  assert(coloured != NULL);
+
+  vertex_pool_free(&coloured->positions);
+  vertex_array_free(&coloured->varray);
+  for (int g = 0; g < Group_Count; ++g) {
+    group_free(coloured->groups + g);
+  }
+  free(coloured->colours);
+  free(coloured->first);
+  free(coloured->next);
+}
+
+static bool colour_vertices(ColouredObject * const coloured,
+                            VertexArray const * const varray,
+                            Group (* const groups)[Group_Count],
+                            const int object_count,
+                            int * const ncoloured,
+                            const unsigned int flags)
+{
+  assert(coloured != NULL);
+  assert(groups != NULL);
+  assert(object_count >= 0);
+  assert(ncoloured != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* No more vertices or positions are needed than there are sides */
+  int nsides = 0;
+  for (int g = 0; g < Group_Count; ++g) {
+    int const n = group_get_num_primitives((*groups) + g);
+    for (int p = 0; p < n; ++p) {
+      _Optional Primitive *const pp = group_get_primitive((*groups) + g, p);
+      if (pp) {
+        nsides += primitive_get_num_sides(&*pp);
+      }
+    }
+  }
+
+  int const nvertices = vertex_array_get_num_vertices(varray);
+  size_t const size = (size_t)(nsides > nvertices ? nsides : nvertices) + 1;
+  coloured->colours = malloc(sizeof(int) * size);
+  coloured->first = malloc(sizeof(int) * size);
+  coloured->next = malloc(sizeof(int) * size);
+  if ((coloured->colours == NULL) || (coloured->first == NULL) ||
+      (coloured->next == NULL)) {
+    fprintf(stderr, "Failed to allocate memory for vertex colours "
+            "(object %d)\n", object_count);
+    return false;
+  }
+
+  int *const colours = &*coloured->colours, *const first = &*coloured->first,
+      *const next = &*coloured->next;
+
+  for (size_t i = 0; i < size; ++i) {
+    first[i] = -1;
+  }
+
+  for (int g = 0; g < Group_Count; ++g) {
+    int const n = group_get_num_primitives((*groups) + g);
+    for (int p = 0; p < n; ++p) {
+      _Optional Primitive *const pp = group_get_primitive((*groups) + g, p);
+      if (!pp) {
+        continue;
+      }
+
+      int const colour = (flags & FLAGS_FALSE_COLOUR) ?
+                         get_false_colour(&*pp, NULL) :
+                         primitive_get_colour(&*pp);
+
+      _Optional Primitive *const copy = copy_primitive(coloured->groups + g,
+                                                       &*pp, p, object_count);
+      if (copy == NULL) {
+        return false;
+      }
+
+      int const nsides = primitive_get_num_sides(&*pp);
+      for (int s = 0; s < nsides; ++s) {
+        int const v = primitive_get_side(&*pp, s);
+        _Optional Coord (* const coords)[3] =
+          vertex_array_get_coords(varray, v);
+        if (!coords) {
+          return false;
+        }
+
+        /* Vertices with the same coordinates are merged unless duplicate
+           vertices are to be kept. */
+        int const pos = (flags & FLAGS_DUPLICATE) ? v :
+                        vertex_pool_find(&coloured->positions, &*coords);
+        if (pos < 0) {
+          fprintf(stderr, "Failed to allocate memory for vertex colours "
+                  "(object %d)\n", object_count);
+          return false;
+        }
+        assert((size_t)pos < size);
+
+        /* Find or add a copy of the vertex with the right colour */
+        int cv;
+        for (cv = first[pos]; (cv >= 0) && (colours[cv] != colour);
+             cv = next[cv]) {
+        }
+
+        if (cv < 0) {
+          cv = vertex_array_add_vertex(&coloured->varray, &*coords);
+          if (cv < 0) {
+            fprintf(stderr, "Failed to allocate vertex memory for vertex "
+                    "colours (object %d)\n", object_count);
+            return false;
+          }
+          assert((size_t)cv < size);
+          colours[cv] = colour;
+          next[cv] = first[pos];
+          first[pos] = cv;
+        }
+
+        if (primitive_add_side(&*copy, cv) < 0) {
+          fprintf(stderr, "Failed to add side: too many sides? "
+                          "(side %d of primitive %d of object %d)\n",
+                  s, p, object_count);
+          return false;
+        }
+      }
+    }
+  }
+
+  vertex_array_set_all_used(&coloured->varray);
+  *ncoloured = vertex_array_renumber(&coloured->varray, false);
+  return true;
+}
+
+static bool output_faces(ObjectOutput * const output,
+                         ScratchFile * const scratch,
+                         const char * const object_name,
+                         const int object_count,
+                         ObjectHeader const * const hdr,
+                         int const vtotal, int const vobject,
+                         VertexArray const * const vnew, int const nnew,
+                         _Optional int const * const vcolours,
+                         VertexArray * const varray,
+                         Group (* const groups)[Group_Count],
+                         const unsigned int flags)
+{
+  assert(output != NULL);
+  assert(nnew >= 0);
+
+  if (output->out_dir != NULL) {
+    assert(vnew == varray);
+    assert(nnew == vobject);
+    return write_object_file(&*output->out_dir, scratch, output->mtl_file,
+                             object_name, object_count, hdr, vobject, varray,
+                             vcolours, groups, flags);
+  }
+
+  /* Each variant has the same vertices, so only the style of faces
+     differs between them. */
+  assert(output->nout > 0);
+  for (int v = 0; v < output->nout; ++v) {
+    OutputVariant const *const variant = output->out + v;
+    assert(!(variant->flags & ~FLAGS_OUTPUT_STYLE));
+    if (!write_object(variant->out, scratch, object_name, hdr, vtotal,
+                      vobject, vnew, nnew, vcolours, varray, groups,
+                      (flags & ~FLAGS_OUTPUT_STYLE) | variant->flags)) {
+      return false;
+    }
+  }
+
+  output->vtotal += nnew;
+  return true;
+}
+
+static bool output_object(ObjectOutput * const output,
+                          ScratchFile * const scratch,
+                          const char * const object_name,
+                          const int object_count,
+                          ObjectHeader const * const hdr,
+                          int const vobject,
+                          VertexArray * const varray,
+                          Group (* const groups)[Group_Count],
+                          const unsigned int flags)
+{
+  assert(output != NULL);
+  assert(output->vtotal >= 0);
+
+  if (flags & FLAGS_VERTEX_COLOURS) {
+    /* Faces refer to a copy of the vertices with one colour each */
+    assert(output->pool == NULL);
+    ColouredObject coloured;
+    coloured_object_init(&coloured);
+
+    int ncoloured;
+    bool success = colour_vertices(&coloured, varray, groups, object_count,
+                                   &ncoloured, flags);
+    if (success) {
+      success = output_faces(output, scratch, object_name, object_count,
+                             hdr, output->vtotal, ncoloured, &coloured.varray,
+                             ncoloured, coloured.colours, &coloured.varray,
+                             &coloured.groups, flags);
+    }
+
+    coloured_object_free(&coloured);
+    return success;
+  }
+
+  if ((output->out_dir == NULL) && (output->pool != NULL)) {
+    /* Only vertices that aren't already in the pool are output, and faces
+       refer to vertices anywhere in the pool. */
+    PooledOutput *const pool = &*output->pool;
+    if (!pool_object(pool, varray, groups, object_count, flags)) {
+      return false;
+    }
+    /* Every vertex in the pool is used and unique, so the pool never needs
+       to be renumbered (which would take time proportional to its size for
+       every object). Only the vertices new to this object are renumbered
+       for output. */
+    vertex_array_set_all_used(&pool->vertices.fresh);
+    int const nnew = vertex_array_renumber(&pool->vertices.fresh, false);
+    int const vall = pool->nvertices + nnew;
+    assert(vall == vertex_array_get_num_vertices(&pool->vertices.varray));
+    if (!output_faces(output, scratch, object_name, object_count, hdr, 0,
+                      vall,
+                      &pool->vertices.fresh, nnew, NULL,
+                      &pool->vertices.varray, &pool->groups, flags)) {
+      return false;
+    }
+    pool->nvertices = vall;
+    return true;
+  }
+
+  return output_faces(output, scratch, object_name, object_count, hdr,
+                      output->vtotal, vobject, varray, vobject, NULL, varray,
+                      groups, flags);
+}
+
+static bool process_object(Reader * const r,
+                           _Optional ObjectOutput * const output,
+                           const char * const object_name,
+                           const int object_count,
+                           VertexArray * const varray,
+                           Group (* const groups)[Group_Count],
+                           ContainerIndex * const containers,
+                           Arena * const arena,
+                           ConvertedObject * const converted,
+                           bool *const list_title,
+                           Coord const thick, long int const data_start,
+                           const unsigned int flags)
+{
+  long int obj_start = 0;
+
+  assert(r != NULL);
+  assert(!reader_ferror(r));
+  assert(object_name != NULL);
+  assert(*object_name != '\0');
+  assert(object_count >= 0);
+  assert(groups != NULL);
+  assert(converted != NULL);
+  assert(thick >= 0);
+  assert(data_start >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  if (flags & FLAGS_LIST) {
+    obj_start = reader_ftell(r);
+  }
+
+  /* Any previously converted object is about to be overwritten */
+  converted->valid = false;
+
+  ObjectHeader hdr;
+  if (!parse_header(r, object_count, &hdr) ||
+      !parse_object(r, object_count, &hdr, varray, groups, containers, thick,
+                    flags)) {
+    return false;
+  }
+
+  if (output != NULL) {
+    int vobject;
+    if (!prepare_object(varray, groups, arena, object_count, &vobject,
+                        flags) ||
+        !output_object(&*output, &(&*output)->scratch, object_name,
+                       object_count, &hdr, vobject, varray, groups, flags)) {
+      return false;
+    }
+
+    *converted = (ConvertedObject){.valid = true, .object_count = object_count,
+                                   .hdr = hdr, .vobject = vobject};
+  }
+
+  if (flags & FLAGS_LIST) {
+    if (!*list_title) {
+      puts("\nIndex  Name          Verts  Prims  SimpV  SimpP      "
+           "Offset        Size");
+      *list_title = true;
+    }
+
+    const long int obj_size = reader_ftell(r) - obj_start;
+    printf("%5d  %-12.12s  %5d  %5d  %5d  %5d  %10ld  %10ld\n",
+           object_count, object_name, (int)hdr.nvertices,
+           (int)hdr.nprimitives, (int)hdr.nsvertices, (int)hdr.nsprimitives,
+           data_start + obj_start, obj_size);
+  }
+
+  return true;
+}
+
+static bool process_alias(ObjectOutput * const output,
+                          const char * const object_name,
+                          const int object_count,
+                          VertexArray * const varray,
+                          Group (* const groups)[Group_Count],
+                          ConvertedObject const * const converted,
+                          const unsigned int flags)
+{
+  assert(output != NULL);
+  assert(object_name != NULL);
+  assert(*object_name != '\0');
+  assert(object_count >= 0);
+  assert(groups != NULL);
+  assert(converted != NULL);
+  assert(converted->valid);
+  assert(!(flags & ~FLAGS_ALL));
+
+  if (flags & FLAGS_VERBOSE) {
+    printf("Object %d has the same address as object %d; "
+           "reusing its converted data\n", object_count,
+           converted->object_count);
+  }
+
+  return output_object(output, &output->scratch, object_name, object_count,
+                       &converted->hdr, converted->vobject, varray, groups,
+                       flags);
+}
+
+static _Optional ObjectBatch *make_batch(int const nthreads,
+                                         int const nslots,
+                                         Coord const thick,
+                                         const unsigned int flags)
+{
+  assert(nthreads >= 1);
+  assert(nslots >= 1);
+  assert(thick >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  _Optional ObjectBatch *const batch = malloc(sizeof(*batch));
+  if (batch == NULL) {
+    fprintf(stderr, "Failed to allocate memory for parallel conversion\n");
+    return NULL;
+  }
+
+  _Optional ObjectSlot *const slots = malloc(sizeof(*slots) * (size_t)nslots);
+  if (slots == NULL) {
+    fprintf(stderr, "Failed to allocate memory for parallel conversion\n");
+    free(batch);
+    return NULL;
+  }
+
+  for (int s = 0; s < nslots; ++s) {
+    ObjectSlot *const slot = &slots[s];
+    vertex_array_init(&slot->varray);
+    for (int g = 0; g < Group_Count; ++g) {
+      group_init(slot->groups + g);
+    }
+    container_index_init(&slot->containers);
+    arena_init(&slot->arena);
+    slot->scratch = (ScratchFile){.f = NULL};
+  }
+
+  *batch = (ObjectBatch){.slots = &*slots, .nslots = nslots, .count = 0,
+                         .nthreads = nthreads, .thick = thick, .flags = flags,
+                         .pipeline = NULL, .pending = -1, .output = NULL};
+  return batch;
+}
+
+static void destroy_batch(ObjectBatch * const batch)
+{
+  assert(batch != NULL);
+
+  for (int s = 0; s < batch->nslots; ++s) {
+    ObjectSlot *const slot = batch->slots + s;
+    for (int g = 0; g < Group_Count; ++g) {
+      group_free(slot->groups + g);
+    }
+    container_index_free(&slot->containers);
+    arena_free(&slot->arena);
+    scratch_file_close(&slot->scratch);
+    vertex_array_free(&slot->varray);
+  }
+  free(batch->slots);
+  free(batch);
+}
+
+static long int estimate_cost(unsigned char * const data, size_t const size,
+                              Coord const thick, unsigned int const flags)
+{
+  assert(data != NULL);
+  assert(thick >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* Bad objects fail quickly, so don't bother estimating their cost */
+  if (size < BytesPerHeader) {
+    return 0;
+  }
+
+  int32_t const simple_dist = get_int32(data),
+                nprimitives = get_int32(data + 4),
+                nvertices = get_int32(data + 8);
+
+  if (nprimitives < 0 || nprimitives >= MaxNumPrimitives ||
+      nvertices < 0 || nvertices >= MaxNumVertices) {
+    return 0;
+  }
+
+  size_t const block_start = BytesPerHeader +
+                             (BytesPerVertex * ((size_t)nvertices + 1));
+  int const n = nprimitives + 1;
+  if (size < block_start + (BytesPerPrimitive * (size_t)n)) {
+    return 0;
+  }
+
+  /* Special primitives such as hatching are expanded into many more
+     primitives, each of which has about two vertices. */
+  long int const nspecial = count_special_vertices(
+    (unsigned char (*)[BytesPerPrimitive])(data + block_start), n,
+    simple_dist, thick, flags);
+
+  long int const nprims = n + (nspecial / 2);
+  long int cost = nvertices + 1 + nspecial + nprims;
+
+  /* Every polygon may be clipped against every other polygon */
+  if (flags & FLAGS_CLIP_POLYGONS) {
+    cost += nprims * nprims;
+  }
+  return cost;
+}
+
+/* Get the size of the vertex and primitive definitions that parse_object
+   reads after an object header, given the raw counts from the header.
+   The counts are validated exactly as by parse_header, which accepts a
+   negative primitive count (as found in objects 37 and 38) but still
+   requires the vertices to be read. Returns 0 if the header would be
+   rejected. */
+static size_t get_body_size(int32_t const nprimitives,
+                            int32_t const nvertices)
+{
+  if ((nprimitives >= MaxNumPrimitives) ||
+      (nvertices < 0) || (nvertices >= MaxNumVertices)) {
+    return 0;
+  }
+
+  size_t size = BytesPerVertex * ((size_t)nvertices + 1);
+  if (nprimitives >= 0) {
+    size += BytesPerPrimitive * ((size_t)nprimitives + 1);
+  }
+  return size;
+}
+
+static bool read_object(ObjectSlot * const slot, Reader * const models,
+                        const char * const object_name,
+                        const int object_count, int32_t const address,
+                        _Optional ObjectSlot * const source)
+{
+  assert(slot != NULL);
+  assert(models != NULL);
+  assert(object_name != NULL);
+  assert(object_count >= 0);
+
+  slot->object_count = object_count;
+  slot->address = address;
+  slot->source = source;
+  slot->cost = 0;
+  slot->success = slot->written = false;
+
+  /* The name may be in a static buffer which is overwritten by the
+     next call to get_obj_name or get_obj_name_extra. */
+  slot->nnames = 1;
+  slot->object_counts[0] = object_count;
+  snprintf(slot->object_names[0], sizeof(slot->object_names[0]), "%s",
+           object_name);
+
+  if (source != NULL) {
+    return true;
+  }
+
+  /* Read the object's definition into memory so that it can be parsed by
+     any thread. Its size depends on counts in the header which aren't
+     validated until later, so don't rely on them to be sensible. */
+  slot->size = reader_fread(slot->data, 1, BytesPerHeader, models);
+  if (slot->size == BytesPerHeader) {
+    int32_t const nprimitives = get_int32(slot->data + 4),
+                  nvertices = get_int32(slot->data + 8);
+
+    size_t const body_size = get_body_size(nprimitives, nvertices);
+    assert(body_size <= sizeof(slot->data) - BytesPerHeader);
+
+    slot->size += reader_fread(slot->data + BytesPerHeader, 1, body_size,
+                               models);
+  }
+
+  if (reader_ferror(models)) {
+    fprintf(stderr, "Failed to read object %d\n", object_count);
+    return false;
+  }
+  return true;
+}
+
+static bool writes_concurrently(ObjectBatch const * const batch)
+{
+  assert(batch != NULL);
+
+  /* Objects in separate files can be written by any thread unless their
+     false colours must be allocated in order. */
+  return (batch->output != NULL) && (batch->output->out_dir != NULL) &&
+         !(batch->flags & FLAGS_FALSE_COLOUR);
+}
+
+static bool write_slot(ObjectBatch * const batch, ObjectSlot * const slot)
+{
+  assert(batch != NULL);
+  assert(batch->output != NULL);
+  assert(slot != NULL);
+
+  ObjectSlot *const src = slot->source != NULL ? &*slot->source : slot;
+  if (!src->success) {
+    return false;
+  }
+
+  /* Only the thread that writes objects in order uses the output's own
+     scratch file. */
+  ScratchFile *const scratch = writes_concurrently(batch) ?
+                               &slot->scratch : &batch->output->scratch;
+
+  for (int n = 0; n < slot->nnames; ++n) {
+    if (!output_object(&*batch->output, scratch, slot->object_names[n],
+                       slot->object_counts[n], &src->hdr, src->vobject,
+                       &src->varray, &src->groups, batch->flags)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void convert_job(void * const arg, int const job)
+{
+  ObjectBatch *const batch = arg;
+  assert(batch != NULL);
+  assert(job >= 0);
+  assert(job < batch->nslots);
+
+  ObjectSlot *const slot = batch->slots + job;
+  if (slot->source == NULL) {
+    Reader r;
+    reader_mem_init(&r, slot->data, slot->size);
+
+    slot->success = parse_header(&r, slot->object_count, &slot->hdr) &&
+                    parse_object(&r, slot->object_count, &slot->hdr,
+                                 &slot->varray, &slot->groups,
+                                 &slot->containers, batch->thick,
+                                 batch->flags) &&
+                    prepare_object(&slot->varray, &slot->groups,
+                                   &slot->arena, slot->object_count,
+                                   &slot->vobject, batch->flags);
+
+    reader_destroy(&r);
+  }
+
+  if (writes_concurrently(batch)) {
+    slot->written = write_slot(batch, slot);
+  }
+}
+
+static bool write_job(void * const arg, int const job)
+{
+  ObjectBatch *const batch = arg;
+  assert(batch != NULL);
+  assert(job >= 0);
+  assert(job < batch->nslots);
+
+  ObjectSlot *const slot = batch->slots + job;
+  if (writes_concurrently(batch)) {
+    return slot->written;
+  }
+
+  /* Vertex numbering for each object depends on the number of vertices
+     in all of the objects before it, and false colours are allocated in
+     the order that primitives are output, so only one thread does this.
+     Nothing after a failure is written. */
+  return write_slot(batch, slot);
+}
+
+static bool start_pipeline(ObjectBatch * const batch,
+                           ObjectOutput * const output)
+{
+  assert(batch != NULL);
+  assert(batch->pipeline == NULL);
+  assert(output != NULL);
+
+  batch->output = output;
+  batch->pending = -1;
+  batch->pipeline = jobs_pipeline_start(batch->nthreads, batch->nslots,
+                                        convert_job, write_job, batch);
+  if (batch->pipeline == NULL) {
+    fprintf(stderr, "Failed to allocate memory for parallel conversion\n");
+    return false;
+  }
+  return true;
+}
+
+static bool queue_object(ObjectBatch * const batch, Reader * const models,
+                         const char * const object_name,
+                         const int object_count, int32_t const address,
+                         _Optional ObjectSlot * const source)
+{
+  assert(batch != NULL);
+  assert(batch->pipeline != NULL);
+  assert(object_name != NULL);
+
+  /* Addresses in the index are in ascending order, so any object with the
+     same address as the one waiting to enter the pipeline follows it
+     directly. Its model data needn't be read or converted again. */
+  if (batch->pending >= 0) {
+    ObjectSlot *const pending = batch->slots + batch->pending;
+    if ((pending->address == address) &&
+        (pending->nnames < MaxNamesPerSlot)) {
+      pending->object_counts[pending->nnames] = object_count;
+      snprintf(pending->object_names[pending->nnames],
+               sizeof(pending->object_names[pending->nnames]), "%s",
+               object_name);
+      ++pending->nnames;
+      return true;
+    }
+
+    jobs_pipeline_put_slot(&*batch->pipeline, batch->pending, pending->cost);
+    batch->pending = -1;
+  }
+
+  /* This waits for an object to be written if all of the slots are in
+     use, which limits how far ahead of the output the input can get. */
+  int const s = jobs_pipeline_get_slot(&*batch->pipeline);
+  if (s < 0) {
+    return false;
+  }
+
+  batch->pending = s;
+  ObjectSlot *const slot = batch->slots + s;
+  if (!read_object(slot, models, object_name, object_count, address,
+                   source)) {
+    return false;
+  }
+
+  if (source == NULL) {
+    slot->cost = estimate_cost(slot->data, slot->size, batch->thick,
+                               batch->flags);
+  }
+  return true;
+}
+
+static bool finish_pipeline(ObjectBatch * const batch, bool success)
+{
+  assert(batch != NULL);
+  assert(batch->pipeline != NULL);
+
+  if (success && (batch->pending >= 0)) {
+    jobs_pipeline_put_slot(&*batch->pipeline, batch->pending,
+                           batch->slots[batch->pending].cost);
+  }
+  batch->pending = -1;
+
+  if (!jobs_pipeline_finish(&*batch->pipeline)) {
+    success = false;
+  }
+  batch->pipeline = NULL;
+  batch->output = NULL;
+  return success;
+}
+
+static bool process_shared(ObjectOutput * const output,
+                           const char * const object_name,
+                           const int object_count, ObjectSlot * const source,
+                           const unsigned int flags)
+{
+  assert(output != NULL);
+  assert(object_name != NULL);
+  assert(*object_name != '\0');
+  assert(object_count >= 0);
+  assert(source != NULL);
+  assert(source->success);
+  assert(!(flags & ~FLAGS_ALL));
+
+  if (flags & FLAGS_VERBOSE) {
+    printf("Object %d is shared with other indices; "
+           "reusing its converted data\n", object_count);
+  }
+
+  return output_object(output, &output->scratch, object_name, object_count,
+                       &source->hdr, source->vobject, &source->varray,
+                       &source->groups, flags);
+}
+
+static bool is_selected(const int object_count, const int first,
+                        const int last, _Optional const char * const name,
+                        const unsigned int flags)
+{
+  assert(object_count >= 0);
+  assert(!(flags & ~FLAGS_ALL));
+
+  if (((object_count < first) && (first != -1)) ||
+      ((object_count > last) && (last != -1))) {
+    return false;
+  }
+
+  if (name == NULL) {
+    return true;
+  }
+
+  return !strcmp(&*name, (flags & FLAGS_EXTRA_MISSIONS) ?
+                         get_obj_name_extra(object_count) :
+                         get_obj_name(object_count));
+}
+
+typedef struct {
+  int32_t offset;
+  int object_count;
+} SharedRef;
+
+static void order_by_cost(int * const order, ObjectBatch const * const batch)
+{
+  assert(order != NULL);
+  assert(batch != NULL);
+
+  /* Insertion sort in descending order of cost */
+  for (int s = 0; s < batch->count; ++s) {
+    int o;
+    for (o = s; (o > 0) &&
+                (batch->slots[order[o - 1]].cost < batch->slots[s].cost);
+         --o) {
+      order[o] = order[o - 1];
+    }
+    order[o] = s;
+  }
+}
+
+static int compare_refs(void const * const a, void const * const b)
+{
+  SharedRef const *const ra = a, *const rb = b;
+  return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+static int compare_slot_offset(void const * const key,
+                               void const * const element)
+{
+  int32_t const offset = *(int32_t const *)key;
+  ObjectSlot const *const slot = element;
+  return (offset > slot->address) - (offset < slot->address);
+}
+
+static _Optional ObjectSlot *find_shared(SharedObjects * const shared,
+                                         long int const offset)
+{
+  assert(shared != NULL);
+  assert(offset >= 0);
+
+  if (offset >= shared->size) {
+    return NULL;
+  }
+
+  int32_t const key = (int32_t)offset;
+  return bsearch(&key, shared->batch->slots, (size_t)shared->batch->count,
+                 sizeof(*shared->batch->slots), compare_slot_offset);
+}
+
+static bool find_shared_refs(Reader * const index, long int const size,
+                             const int first, const int last,
+                             _Optional const char * const name,
+                             _Optional SharedRef ** const refs,
+                             int * const nrefs,
+                             int * const capacity, const unsigned int flags)
+{
+  assert(index != NULL);
+  assert(size >= 0);
+  assert(refs != NULL);
+  assert(nrefs != NULL);
+  assert(capacity != NULL);
+  assert(!(flags & ~FLAGS_ALL));
+
+  int32_t address, last_address = 0, first_address = -1;
+  bool stop = false;
+  for (int object_count = 0;
+       !stop && ((last == -1) || (object_count <= last)); ++object_count) {
+    if (!reader_fread_int32(&address, index)) {
+      if (reader_ferror(index)) {
+        fprintf(stderr, "Failed to read from index file (object %d)\n",
+                object_count);
+        return false;
+      }
+      break;
+    }
+    if (address < last_address) {
+      fprintf(stderr, "Bad address %" PRId32 " (0x%" PRIx32 ") "
+              "for object %d in index\n", address, address, object_count);
+      return false;
+    }
+
+    last_address = address;
+
+    if (first_address < 0) {
+      first_address = address;
+    }
+
+    if (!is_selected(object_count, first, last, name, flags)) {
+      continue;
+    }
+
+    /* Stop after finding the named object, as choc_to_obj does, so that
+       both agree about which objects are selected. */
+    if (name != NULL) {
+      stop = true;
+    }
+
+    int32_t const offset = address - first_address;
+    if (offset >= size) {
+      continue;
+    }
+
+    if (*nrefs == *capacity) {
+      int const new_capacity = *capacity ? *capacity * 2 : MaxNumVertices;
+      _Optional SharedRef *const new_refs =
+        realloc(*refs, sizeof(**refs) * (size_t)new_capacity);
+      if (new_refs == NULL) {
+        fprintf(stderr, "Failed to allocate memory for shared objects\n");
+        return false;
+      }
+      *refs = new_refs;
+      *capacity = new_capacity;
+    }
+
+    (&**refs)[(*nrefs)++] = (SharedRef){.offset = offset,
+                                        .object_count = object_count};
+  }
+
+  if (reader_fseek(index, 0, SEEK_SET)) {
+    fprintf(stderr, "Failed to rewind index file\n");
+    return false;
+  }
+
+  return true;
+}
+
+_Optional SharedObjects *shared_objects_create(Reader * const indices[],
+                                               const int nindices,
+                                               Reader * const models,
+                                               long int const size,
+                                               const int first,
+                                               const int last,
+                                               _Optional const char *
+                                                 const name,
+                                               double const thick,
+                                               const int jobs,
+                                               const unsigned int flags)
+{
+  assert(indices != NULL);
+  assert(nindices > 0);
+  assert(models != NULL);
+  assert(size >= 0);
+  assert(first >= 0);
+  assert(last == -1 || last >= first);
+  assert(thick >= 0);
+  assert(jobs >= 1);
+  assert(!(flags & ~FLAGS_ALL));
+
+  /* Find every object in the shared model data that is selected from
+     any of the indices. */
+  _Optional SharedRef *refs = NULL;
+  int nrefs = 0, capacity = 0;
+  bool success = true;
+  for (int i = 0; success && (i < nindices); ++i) {
+    assert(indices[i] != NULL);
+    success = find_shared_refs(indices[i], size, first, last, name, &refs,
+                               &nrefs, &capacity, flags);
+  }
+
+  /* Objects shared between indices (or aliased within one) are converted
+     only once. */
+  int nunique = 0;
+  if (success && (refs != NULL)) {
+    SharedRef *const sorted = &*refs;
+    qsort(sorted, (size_t)nrefs, sizeof(*sorted), compare_refs);
+    for (int r = 0; r < nrefs; ++r) {
+      if ((r == 0) || (sorted[r].offset != sorted[r - 1].offset)) {
+        sorted[nunique++] = sorted[r];
+      }
+    }
+  }
+
+  /* Diagnostic output describes each object as it is converted, so it
+     is only produced serially. */
+  int const nthreads = (flags & FLAGS_VERBOSE) ? 1 : jobs;
+  _Optional SharedObjects *shared = NULL;
+  _Optional ObjectBatch *batch = NULL;
+  if (success) {
+    shared = malloc(sizeof(*shared));
+    batch = make_batch(nthreads, nunique > 0 ? nunique : 1, thick, flags);
+    if ((shared == NULL) || (batch == NULL)) {
+      fprintf(stderr, "Failed to allocate memory for shared objects\n");
+      success = false;
+    }
+  }
+
+  if (success && (flags & FLAGS_VERBOSE)) {
+    printf("Converting %d shared object%s\n", nunique,
+           nunique != 1 ? "s" : "");
+  }
+
+  for (int r = 0; success && (r < nunique); ++r) {
+    SharedRef const *const ref = &*refs + r;
+    if (reader_fseek(models, ref->offset, SEEK_SET)) {
+      fprintf(stderr, "Failed to seek shared object %d at offset %" PRId32
+              " (0x%" PRIx32 ")\n", ref->object_count, ref->offset,
+              ref->offset);
+      success = false;
+      break;
+    }
+
+    const char * const object_name = (flags & FLAGS_EXTRA_MISSIONS) ?
+                                     get_obj_name_extra(ref->object_count) :
+                                     get_obj_name(ref->object_count);
+
+    ObjectSlot *const slot = batch->slots + batch->count++;
+    success = read_object(slot, models, object_name, ref->object_count,
+                          ref->offset, NULL);
+    if (success) {
+      slot->cost = estimate_cost(slot->data, slot->size, batch->thick, flags);
+    }
+  }
+
+  free(refs);
+
+  if (success) {
+    /* Start the most expensive objects first so that threads aren't left
+       idle whilst one of them converts a large object at the end. If
+       there isn't enough memory to sort them, just start in any order. */
+    _Optional int *const order = malloc(sizeof(*order) *
+                                        (size_t)batch->count);
+    if (order != NULL) {
+      order_by_cost(&*order, &*batch);
+    }
+    jobs_run_ordered(nthreads, batch->count, order, convert_job, &*batch);
+    free(order);
+
+    for (int s = 0; s < batch->count; ++s) {
+      if (!batch->slots[s].success) {
+        success = false;
+        break;
+      }
+    }
+  }
+
+  if (!success) {
+    if (batch != NULL) {
+      destroy_batch(&*batch);
+    }
+    free(shared);
+    return NULL;
+  }
+
+  *shared = (SharedObjects){.batch = &*batch, .size = size};
+  return shared;
+}
+
+void shared_objects_destroy(_Optional SharedObjects * const shared)
+{
+  if (shared != NULL) {
+    destroy_batch(shared->batch);
+    free(shared);
+  }
+}
+
+bool choc_to_obj(Reader * const index, Reader * const models,
+                 int const nout, OutputVariant const out[],
+                 _Optional const char * const out_dir,
+                 const int first, const int last,
+                 _Optional const char * const name, const long int data_start,
+                 const char * const mtl_file, double const thick,
+                 const int jobs, _Optional SharedObjects * const shared,
+                 const unsigned int flags)
+{
+  bool success = true;
+  Group groups[Group_Count];
+  for (int g = 0; g < Group_Count; ++g) {
+    group_init(groups + g);
+  }
+  ContainerIndex containers;
+  container_index_init(&containers);
+  Arena arena;
+  arena_init(&arena);
+  VertexArray varray;
+  vertex_array_init(&varray);
+  ConvertedObject converted = {.valid = false};
+  PooledOutput pooled = {.nvertices = 0};
+  vertex_pool_init(&pooled.vertices);
+  for (int g = 0; g < Group_Count; ++g) {
+    group_init(pooled.groups + g);
+  }
+
+  /* A vertex pool is only useful if all objects go to the same file */
+  ObjectOutput output = {.nout = nout, .out = out, .out_dir = out_dir,
+                         .mtl_file = mtl_file, .vtotal = 0,
+                         .pool = ((flags & FLAGS_VERTEX_POOL) && (nout > 0)) ?
+                                 &pooled : NULL};
+  _Optional ObjectOutput *const dest = (nout > 0 || out_dir != NULL) ?
+                                       &output : NULL;
+
+  assert(index != NULL);
+  assert(!reader_ferror(index));
+  assert(models != NULL);
   assert(!reader_ferror(models));
   assert(first >= 0);
   assert(last == -1 || last >= first);
   assert(mtl_file != NULL);
   assert(thick >= 0);
+  assert(jobs >= 1);
+  assert(nout >= 0);
+  assert(out != NULL);
+  assert((nout == 0) || (out_dir == NULL));
+  assert((shared == NULL) || ((dest != NULL) && !(flags & FLAGS_LIST)));
   assert(!(flags & ~FLAGS_ALL));
 
-  if ((out != NULL) &&
-      fprintf(out, "# Chocks Away graphics\n"
-                   "# Converted by ChoctoObj "VERSION_STRING"\n"
-                   "mtllib %s\n", mtl_file) < 0) {
-    fprintf(stderr, "Failed writing to output file: %s\n",
-            strerror(errno));
+  /* This must be done before any worker threads are started */
+  init_material_names();
+
+  /* Diagnostic output and listings describe each object as it is read
+     from the model data file, so they are only produced serially. */
+  _Optional ObjectBatch *batch = NULL;
+  if ((jobs > 1) && (dest != NULL) &&
+      !(flags & (FLAGS_VERBOSE | FLAGS_LIST | FLAGS_SUMMARY))) {
+    batch = make_batch(jobs, jobs * SlotsPerThread, thick, flags);
+    if (batch == NULL) {
+      success = false;
+    }
+  }
+
+  if (!success) {
+    /* Nothing to do */
+  } else if (!write_headers(nout, out, mtl_file, flags)) {
+    success = false;
+  } else if ((batch != NULL) && !start_pipeline(&*batch, &*dest)) {
     success = false;
   } else {
     /* Read each object address in turn until reaching the
@@ -1688,6 +3547,32 @@ bool choc_to_obj(Reader * const index, Reader * const models,
         stop = true;
       }
 
+      /* Shared objects were converted in advance */
+      _Optional ObjectSlot *const source = (shared != NULL) ?
+                                           find_shared(&*shared, offset) :
+                                           NULL;
+      if (source == NULL) {
+        /* Read and convert the object below */
+      } else if (batch != NULL) {
+        success = queue_object(&*batch, models, object_name, object_count,
+                               address, source);
+        continue;
+      } else {
+        success = process_shared(&*dest, object_name, object_count,
+                                 &*source, flags);
+        continue;
+      }
+
+      if ((batch == NULL) && (dest != NULL) && !(flags & FLAGS_LIST) &&
+          converted.valid && (converted.address == address)) {
+        /* Addresses in the index are in ascending order, so objects that
+           share model data are consecutive (apart from any skipped). The
+           model data was already found, so it isn't sought again. */
+        success = process_alias(&*dest, object_name, object_count, &varray,
+                                &groups, &converted, flags);
+        continue;
+      }
+
       if (offset < data_start) {
         if (flags & FLAGS_VERBOSE) {
           printf("Object %d at offset %ld (0x%lx) "
@@ -1728,9 +3613,20 @@ bool choc_to_obj(Reader * const index, Reader * const models,
                object_count, file_pos, file_pos);
       }
 
-      success = process_object(models, out, object_name, object_count,
-                               &varray, &groups, &vtotal, &list_title,
-                               thick, data_start, flags);
+      if (batch != NULL) {
+        success = queue_object(&*batch, models, object_name, object_count,
+                               address, NULL);
+      } else {
+        success = process_object(models, dest, object_name, object_count,
+                                 &varray, &groups, &containers, &arena,
+                                 &converted, &list_title, thick,
+                                 data_start, flags);
+        converted.address = address;
+      }
+    }
+
+    if (batch != NULL) {
+      success = finish_pipeline(&*batch, success);
     }
 
     if (success && (flags & FLAGS_SUMMARY)) {
@@ -1739,9 +3635,18 @@ bool choc_to_obj(Reader * const index, Reader * const models,
     }
   }
 
+  if (batch != NULL) {
+    destroy_batch(&*batch);
+  }
+
   for (int g = 0; g < Group_Count; ++g) {
     group_free(groups + g);
+    group_free(pooled.groups + g);
   }
+  vertex_pool_free(&pooled.vertices);
+  scratch_file_close(&output.scratch);
+  container_index_free(&containers);
+  arena_free(&arena);
   vertex_array_free(&varray);
 
   return success;
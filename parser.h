@@ -18,9 +18,40 @@
 #define _Optional
 #endif
 
-bool choc_to_obj(Reader *index, Reader *models, FILE *out, const int first,
-                 const int last, _Optional const char *name,
+/* One of several files to which every converted object is written, each
+   in a different style (for example, using triangle strips) */
+typedef struct {
+  FILE *out;
+  unsigned int flags; /* Replace the FLAGS_OUTPUT_STYLE bits of the flags */
+} OutputVariant;
+
+/* Objects in model data common to several indices, such as the Land file
+   of Extra Missions, which are converted once for use with every index */
+typedef struct SharedObjects SharedObjects;
+
+/* Convert every selected object whose offset from the lowest address in
+   any of the given indices is less than 'size'. Each index is rewound
+   afterwards. */
+_Optional SharedObjects *shared_objects_create(Reader *const indices[],
+                                               int nindices, Reader *models,
+                                               long int size, int first,
+                                               int last,
+                                               _Optional const char *name,
+                                               double thick, int jobs,
+                                               unsigned int flags);
+
+void shared_objects_destroy(_Optional SharedObjects *shared);
+
+/* Convert objects to one or more output files (out, each with the same
+   objects in a different style) or one file per object in a directory
+   (out_dir). If neither is specified then objects are only listed or
+   summarized. */
+bool choc_to_obj(Reader *index, Reader *models, int nout,
+                 OutputVariant const out[], _Optional const char *out_dir,
+                 const int first, const int last, _Optional const char *name,
                  const long int data_start, const char *mtl_file,
-                 double const thick, const unsigned int flags);
+                 double const thick, const int jobs,
+                 _Optional SharedObjects *shared,
+                 const unsigned int flags);
 
 #endif /* PARSER_H */
@@ -0,0 +1,296 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Sidecar file of decompressed model data
+ *  Copyright (C) 2018 Christopher Bazley
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public Licence as published by
+ *  the Free Software Foundation; either version 2 of the Licence, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public Licence for more details.
+ *
+ *  You should have received a copy of the GNU General Public Licence
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* ISO library header files */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/* StreamLib headers */
+#include "Reader.h"
+#include "ReaderGKey.h"
+#include "ReaderMem.h"
+#include "ReaderRaw.h"
+
+/* Local header files */
+#include "sidecar.h"
+#include "filebuf.h"
+#include "misc.h"
+
+/* The decompressed data is followed by a trailer identifying the
+   compressed file from which it was created. The trailer is written last
+   so that an incomplete sidecar file is never mistaken for a valid one. */
+enum {
+  TrailerMagicSize = 8,
+  TrailerCompressedSize = TrailerMagicSize,
+  TrailerChecksum = TrailerCompressedSize + 4,
+  TrailerDecompressedSize = TrailerChecksum + 4,
+  TrailerSize = TrailerDecompressedSize + 4,
+  CopyBufferSize = 4096
+};
+
+static const char trailer_magic[TrailerMagicSize] = "ChocDcmp";
+
+static uint32_t update_checksum(uint32_t hash,
+                                unsigned char const * const data,
+                                size_t const size)
+{
+  /* 32-bit FNV-1a hash */
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Identify compressed data without decompressing it or holding all of it
+   in memory at once. */
+static bool get_checksum(FILE * const compressed,
+                         uint32_t * const compressed_size,
+                         uint32_t * const checksum)
+{
+  assert(compressed != NULL);
+  assert(compressed_size != NULL);
+  assert(checksum != NULL);
+
+  unsigned char buf[CopyBufferSize];
+  uint32_t hash = 2166136261u, size = 0;
+  size_t n;
+  do {
+    n = fread(buf, 1, sizeof(buf), compressed);
+    hash = update_checksum(hash, buf, n);
+    size += (uint32_t)n;
+  } while (n > 0);
+
+  if (ferror(compressed)) {
+    return false;
+  }
+
+  *compressed_size = size;
+  *checksum = hash;
+  return true;
+}
+
+static void put_uint32(unsigned char * const bytes, uint32_t const value)
+{
+  bytes[0] = (unsigned char)value;
+  bytes[1] = (unsigned char)(value >> 8);
+  bytes[2] = (unsigned char)(value >> 16);
+  bytes[3] = (unsigned char)(value >> 24);
+}
+
+static uint32_t get_uint32(unsigned char const * const bytes)
+{
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+         ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static bool check_sidecar(FILE * const f, uint32_t const compressed_size,
+                          uint32_t const checksum, long int * const size)
+{
+  assert(f != NULL);
+  assert(size != NULL);
+
+  if (fseek(f, 0, SEEK_END)) {
+    return false;
+  }
+
+  long int const file_size = ftell(f);
+  if ((file_size < TrailerSize) ||
+      fseek(f, file_size - TrailerSize, SEEK_SET)) {
+    return false;
+  }
+
+  unsigned char trailer[TrailerSize];
+  if (fread(trailer, sizeof(trailer), 1, f) != 1) {
+    return false;
+  }
+
+  *size = file_size - TrailerSize;
+  return !memcmp(trailer, trailer_magic, TrailerMagicSize) &&
+         (get_uint32(trailer + TrailerCompressedSize) == compressed_size) &&
+         (get_uint32(trailer + TrailerChecksum) == checksum) &&
+         (get_uint32(trailer + TrailerDecompressedSize) ==
+            (uint32_t)*size);
+}
+
+static bool write_sidecar(FILE * const compressed,
+                          const char * const sidecar_file,
+                          int const history_log2,
+                          uint32_t const compressed_size,
+                          uint32_t const checksum)
+{
+  assert(compressed != NULL);
+  assert(sidecar_file != NULL);
+
+  rewind(compressed);
+
+  Reader r;
+  if (!reader_gkey_init(&r, history_log2, compressed)) {
+    fprintf(stderr, "Failed to initialize decompression for sidecar "
+            "file '%s'\n", sidecar_file);
+    return false;
+  }
+
+  bool success = true;
+  _Optional FILE *const f = fopen(sidecar_file, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to open sidecar file '%s': %s\n",
+            sidecar_file, strerror(errno));
+    success = false;
+  } else {
+    /* Only a small buffer's worth of decompressed data is held in memory
+       at any one time. */
+    unsigned char buf[CopyBufferSize];
+    uint32_t decompressed_size = 0;
+    size_t n;
+    do {
+      n = reader_fread(buf, 1, sizeof(buf), &r);
+      if (fwrite(buf, 1, n, &*f) != n) {
+        fprintf(stderr, "Failed writing to sidecar file '%s': %s\n",
+                sidecar_file, strerror(errno));
+        success = false;
+      }
+      decompressed_size += (uint32_t)n;
+    } while (success && (n > 0));
+
+    if (success && reader_ferror(&r)) {
+      fprintf(stderr, "Failed to decompress data for sidecar file '%s'\n",
+              sidecar_file);
+      success = false;
+    }
+
+    if (success) {
+      unsigned char trailer[TrailerSize];
+      memcpy(trailer, trailer_magic, TrailerMagicSize);
+      put_uint32(trailer + TrailerCompressedSize, compressed_size);
+      put_uint32(trailer + TrailerChecksum, checksum);
+      put_uint32(trailer + TrailerDecompressedSize, decompressed_size);
+
+      if (fwrite(trailer, sizeof(trailer), 1, &*f) != 1) {
+        fprintf(stderr, "Failed writing to sidecar file '%s': %s\n",
+                sidecar_file, strerror(errno));
+        success = false;
+      }
+    }
+
+    if (fclose(&*f)) {
+      fprintf(stderr, "Failed to close sidecar file '%s': %s\n",
+              sidecar_file, strerror(errno));
+      success = false;
+    }
+
+    if (!success) {
+      remove(sidecar_file);
+    }
+  }
+
+  reader_destroy(&r);
+  return success;
+}
+
+static bool load_sidecar(Sidecar * const sidecar, Reader * const r,
+                         const char * const sidecar_file,
+                         uint32_t const compressed_size,
+                         uint32_t const checksum)
+{
+  assert(sidecar != NULL);
+  assert(r != NULL);
+  assert(sidecar_file != NULL);
+
+  _Optional FILE *const f = fopen(sidecar_file, "rb");
+  if (f == NULL) {
+    return false;
+  }
+
+  long int size;
+  if (!check_sidecar(&*f, compressed_size, checksum, &size)) {
+    fclose(&*f);
+    return false;
+  }
+
+  rewind(&*f);
+
+  /* A mapping remains valid after the file has been closed. Otherwise,
+     the data is read from the file on demand instead of being loaded onto
+     the heap. */
+  if (file_buffer_map(&sidecar->fb, &*f)) {
+    fclose(&*f);
+    reader_mem_init(r, file_buffer_get_data(&sidecar->fb), (size_t)size);
+  } else {
+    sidecar->f = f;
+    reader_raw_init(r, &*f);
+  }
+  return true;
+}
+
+bool sidecar_load(Sidecar * const sidecar, Reader * const r,
+                  FILE * const compressed, const char * const sidecar_file,
+                  int const history_log2, bool const verbose)
+{
+  assert(sidecar != NULL);
+  assert(r != NULL);
+  assert(compressed != NULL);
+  assert(sidecar_file != NULL);
+
+  *sidecar = (Sidecar){.fb = {.data = NULL}, .f = NULL};
+
+  uint32_t compressed_size, checksum;
+  if (!get_checksum(compressed, &compressed_size, &checksum)) {
+    fprintf(stderr, "Failed to read compressed data for sidecar file '%s': "
+            "%s\n", sidecar_file, strerror(errno));
+    return false;
+  }
+
+  if (load_sidecar(sidecar, r, sidecar_file, compressed_size, checksum)) {
+    if (verbose) {
+      printf("Using decompressed data from sidecar file '%s'\n",
+             sidecar_file);
+    }
+  } else {
+    if (verbose) {
+      printf("Creating sidecar file '%s'\n", sidecar_file);
+    }
+
+    if (!write_sidecar(compressed, sidecar_file, history_log2,
+                       compressed_size, checksum)) {
+      return false;
+    }
+
+    if (!load_sidecar(sidecar, r, sidecar_file, compressed_size, checksum)) {
+      fprintf(stderr, "Failed to load sidecar file '%s'\n", sidecar_file);
+      return false;
+    }
+  }
+  return true;
+}
+
+void sidecar_free(Sidecar * const sidecar)
+{
+  assert(sidecar != NULL);
+
+  file_buffer_free(&sidecar->fb);
+  if (sidecar->f != NULL) {
+    fclose(&*sidecar->f);
+    sidecar->f = NULL;
+  }
+}
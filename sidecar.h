@@ -0,0 +1,43 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Sidecar file of decompressed model data
+ *  Copyright (C) 2018 Christopher Bazley
+ */
+
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+/* ISO C library headers */
+#include <stdbool.h>
+#include <stdio.h>
+
+/* StreamLib headers */
+#include "Reader.h"
+
+/* Local headers */
+#include "filebuf.h"
+
+#if !defined(USE_OPTIONAL) && !defined(_Optional)
+#define _Optional
+#endif
+
+/* Decompressed data in a sidecar file, which is either mapped into memory
+   or else read from the open file on demand. It is never read into a heap
+   block in its entirety. */
+typedef struct {
+  FileBuffer fb; /* Mapping of the sidecar file, if possible */
+  _Optional FILE *f; /* Otherwise, the open sidecar file */
+} Sidecar;
+
+/* Get the decompressed contents of a compressed file from a sidecar file,
+   first creating the sidecar file if it doesn't exist or doesn't match the
+   compressed file. On success, 'r' is initialized to read the decompressed
+   data, and must be destroyed before calling sidecar_free. If the sidecar
+   file cannot be mapped then the trailer that identifies the compressed
+   file follows the data readable from 'r'. */
+bool sidecar_load(Sidecar *sidecar, Reader *r, FILE *compressed,
+                  const char *sidecar_file, int history_log2, bool verbose);
+
+void sidecar_free(Sidecar *sidecar);
+
+#endif /* SIDECAR_H */
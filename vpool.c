@@ -0,0 +1,169 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Vertex pool shared by all objects in one output file
+ *  Copyright (C) 2018 Christopher Bazley
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public Licence as published by
+ *  the Free Software Foundation; either version 2 of the Licence, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public Licence for more details.
+ *
+ *  You should have received a copy of the GNU General Public Licence
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* ISO library header files */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* 3dObjLib headers */
+#include "Coord.h"
+#include "Vertex.h"
+
+/* Local header files */
+#include "vpool.h"
+#include "misc.h"
+
+enum {
+  MinSlots = 1 << 10
+};
+
+void vertex_pool_init(VertexPool * const pool)
+{
+  assert(pool != NULL);
+
+  vertex_array_init(&pool->varray);
+  vertex_array_init(&pool->fresh);
+  pool->slots = NULL;
+  pool->nslots = 0;
+}
+
+void vertex_pool_begin(VertexPool * const pool)
+{
+  assert(pool != NULL);
+  vertex_array_clear(&pool->fresh);
+}
+
+static size_t get_hash(Coord (* const coords)[3])
+{
+  assert(coords != NULL);
+
+  uint64_t hash = 14695981039346656037u; /* 64-bit FNV-1a offset basis */
+  for (size_t dim = 0; dim < ARRAY_SIZE(*coords); ++dim) {
+    /* Adding zero converts negative zero to positive zero, which would
+       otherwise have a different representation despite being equal. */
+    Coord const c = (*coords)[dim] + 0.0;
+    unsigned char bytes[sizeof(c)];
+    memcpy(bytes, &c, sizeof(c));
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+      hash ^= bytes[i];
+      hash *= 1099511628211u;
+    }
+  }
+  return (size_t)(hash ^ (hash >> 32));
+}
+
+static int *find_slot(VertexPool * const pool, Coord (* const coords)[3])
+{
+  assert(pool != NULL);
+  assert(pool->slots != NULL);
+  assert(coords != NULL);
+
+  /* Linear probing finds either the matching vertex or an empty slot */
+  size_t const mask = (size_t)pool->nslots - 1;
+  size_t i = get_hash(coords) & mask;
+  for (;;) {
+    int *const slot = &*pool->slots + i;
+    if (*slot < 0) {
+      return slot;
+    }
+
+    _Optional Coord (* const other)[3] =
+      vertex_array_get_coords(&pool->varray, *slot);
+    if (other && ((*other)[0] == (*coords)[0]) &&
+        ((*other)[1] == (*coords)[1]) && ((*other)[2] == (*coords)[2])) {
+      return slot;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+static bool grow_slots(VertexPool * const pool)
+{
+  assert(pool != NULL);
+
+  int const nslots = pool->nslots ? pool->nslots * 2 : MinSlots;
+  _Optional int *const slots = malloc(sizeof(*slots) * (size_t)nslots);
+  if (slots == NULL) {
+    return false;
+  }
+
+  for (int s = 0; s < nslots; ++s) {
+    (&*slots)[s] = -1;
+  }
+
+  free(pool->slots);
+  pool->slots = slots;
+  pool->nslots = nslots;
+
+  /* Vertices in the pool are unique, so each needs only an empty slot */
+  int const nvertices = vertex_array_get_num_vertices(&pool->varray);
+  for (int v = 0; v < nvertices; ++v) {
+    _Optional Coord (* const coords)[3] =
+      vertex_array_get_coords(&pool->varray, v);
+    if (coords) {
+      *find_slot(pool, &*coords) = v;
+    }
+  }
+  return true;
+}
+
+int vertex_pool_find(VertexPool * const pool, Coord (* const coords)[3])
+{
+  assert(pool != NULL);
+  assert(coords != NULL);
+
+  /* Keep the hash table no more than half full */
+  int const nvertices = vertex_array_get_num_vertices(&pool->varray);
+  if ((nvertices >= pool->nslots / 2) && !grow_slots(pool)) {
+    return -1;
+  }
+
+  int *const slot = find_slot(pool, coords);
+  if (*slot >= 0) {
+    return *slot;
+  }
+
+  int const v = vertex_array_add_vertex(&pool->varray, coords);
+  if (v < 0) {
+    return -1;
+  }
+
+  if (vertex_array_add_vertex(&pool->fresh, coords) < 0) {
+    return -1;
+  }
+
+  vertex_array_set_used(&pool->varray, v);
+  *slot = v;
+  return v;
+}
+
+void vertex_pool_free(VertexPool * const pool)
+{
+  assert(pool != NULL);
+
+  free(pool->slots);
+  pool->slots = NULL;
+  pool->nslots = 0;
+  vertex_array_free(&pool->fresh);
+  vertex_array_free(&pool->varray);
+}
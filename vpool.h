@@ -0,0 +1,43 @@
+/*
+ *  ChoctoObj - Converts Chocks Away graphics to Wavefront format
+ *  Vertex pool shared by all objects in one output file
+ *  Copyright (C) 2018 Christopher Bazley
+ */
+
+#ifndef VPOOL_H
+#define VPOOL_H
+
+/* ISO C library headers */
+#include <stdbool.h>
+
+/* 3dObjLib headers */
+#include "Coord.h"
+#include "Vertex.h"
+
+#if !defined(USE_OPTIONAL) && !defined(_Optional)
+#define _Optional
+#endif
+
+/* Every distinct vertex is added to the pool once, in the order in which
+   the vertices are written to the output file. A hash table of the exact
+   coordinates finds any vertex that was already added. */
+typedef struct {
+  VertexArray varray; /* All vertices, marked as used */
+  VertexArray fresh; /* Vertices added since vertex_pool_begin */
+  _Optional int *slots; /* Indices into varray, or -1 if empty */
+  int nslots; /* Zero or a power of two */
+} VertexPool;
+
+void vertex_pool_init(VertexPool *pool);
+
+/* Start adding the vertices of another object */
+void vertex_pool_begin(VertexPool *pool);
+
+/* Get the index of a vertex with the given coordinates, adding it to the
+   pool if it isn't already there.
+   Returns a negative value on failure. */
+int vertex_pool_find(VertexPool *pool, Coord (*coords)[3]);
+
+void vertex_pool_free(VertexPool *pool);
+
+#endif /* VPOOL_H */